@@ -537,7 +537,7 @@
  *
  * @note    The default is @p FALSE.
  */
-#define CH_DBG_FILL_THREADS                 FALSE
+#define CH_DBG_FILL_THREADS                 TRUE     // stack high-water marks in LED_GET_STATS
 
 /**
  * @brief   Debug option, threads profiling.
@@ -648,9 +648,13 @@
  * @details This hook is continuously invoked by the idle thread loop.
  */
 #define CH_CFG_IDLE_LOOP_HOOK() {                                           \
-  /* Idle loop code here.*/                                                 \
+  perf_idleLoopHook();                                                      \
 }
 
+#if !defined(_FROM_ASM_)
+void perf_idleLoopHook(void);
+#endif
+
 /**
  * @brief   System tick event hook.
  * @details This hook is invoked in the system tick handler immediately
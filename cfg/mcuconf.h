@@ -50,7 +50,7 @@
  * Peripheral driver settings
  */
 
-#define HT32_GPT_USE_BFTM0                  FALSE
+#define HT32_GPT_USE_BFTM0                  TRUE
 #define HT32_GPT_BFTM0_IRQ_PRIORITY         3
 
 #define HT32_SERIAL_USE_USART0              FALSE
@@ -0,0 +1,115 @@
+/*
+ * Host benchmark of the profile tick functions.
+ * Every profile is run for BENCH_FRAMES frames on a virtual clock advancing
+ * at the profile's fps; the wall time per frame is reported in ns.
+ * Build against two source trees (make bench-compare) to compare a change.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "profiles.h"
+#include "miniFastLED.h"
+
+
+#define BENCH_FRAMES 20000
+
+typedef struct {
+    const char* name;
+    const Profile* profile;
+    const Effect* effect;
+} benchProfile;
+
+static const benchProfile benchProfiles[] = {
+    { "rainbow_flow", &prof_rainbowFlow, 0 },
+    { "rain", &prof_rain, 0 },
+    { "storm", &prof_storm, 0 },
+    { "breathing", &prof_breathing, 0 },
+    { "blink", &prof_blink, 0 },
+    { "snowing", &prof_snowing, 0 },
+    { "locked", &prof_locked, 0 },
+    { "stars", &prof_stars, 0 },
+    { "sunny", &prof_sunny, 0 },
+    { "cloudy", &prof_cloudy, 0 },
+    { "weave_effect", 0, &effect_weave_green },
+};
+
+static led_t ledColors[NUM_ROW * NUM_COLUMN];
+static volatile uint8_t sink;
+
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+static uint32_t state[PROFILE_STATE_SIZE / sizeof(uint32_t)];
+
+static void effectTick(const Effect* effect) {
+    // restart the one-shot effect whenever it finishes
+    if (!effect->tick(state))
+        effect->init(ledColors, state);
+
+    memset(ledColors, 0, sizeof(ledColors));
+    effect->draw(ledColors, state);
+}
+
+
+static double benchProfile_run(const benchProfile* bench) {
+    const Profile* profile = bench->profile;
+    const Effect* effect = bench->effect;
+    uint8_t fps = profile ? profile->fps : effect->fps;
+
+    memset(ledColors, 0, sizeof(ledColors));
+    memset(state, 0, sizeof(state));
+    if (profile && profile->init)
+        profile->init(ledColors, state);
+    if (effect)
+        effect->init(ledColors, state);
+
+    uint64_t start = nowNs();
+    for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+        host_advanceTime(CH_CFG_ST_FREQUENCY / fps);
+
+        if (effect) {
+            effectTick(effect);
+        }
+        else {
+            // breathing only lights pressed keys
+            if (profile->keypress && frame % 8 == 0)
+                profile->keypress(frame % NUM_COLUMN, frame % NUM_ROW, ledColors, state);
+
+            profile->tick(ledColors, state);
+        }
+
+        sink ^= ledColors[frame % (NUM_ROW * NUM_COLUMN)].red;
+    }
+
+    return (double)(nowNs() - start) / BENCH_FRAMES;
+}
+
+
+static double benchHsv2rgb(void) {
+    uint8_t rgb[3];
+    uint64_t start = nowNs();
+
+    for (int i = 0; i < BENCH_FRAMES * 16; i++) {
+        hsv2rgb(i, 255 - (i >> 8), i >> 4, rgb);
+        sink ^= rgb[0] ^ rgb[1] ^ rgb[2];
+    }
+
+    return (double)(nowNs() - start) / (BENCH_FRAMES * 16);
+}
+
+
+int main(void) {
+    for (size_t i = 0; i < sizeof(benchProfiles) / sizeof(*benchProfiles); i++) {
+        printf("%-16s %8.1f\n", benchProfiles[i].name, benchProfile_run(&benchProfiles[i]));
+    }
+
+    printf("%-16s %8.1f\n", "hsv2rgb", benchHsv2rgb());
+
+    return 0;
+}
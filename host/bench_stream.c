@@ -0,0 +1,152 @@
+/*
+ * Host benchmark of the streaming encodings.
+ * Every profile is recorded for STREAM_FRAMES frames on a virtual clock,
+ * each frame is encoded as the host would send it and decoded by the
+ * firmware's led_stream.c. Reports the average bytes per frame on the
+ * wire and the frame rate that fits in BENCH_BAUD.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "led_state.h"
+#include "stream_encode.h"
+
+
+#define STREAM_FRAMES   600
+#define BENCH_BAUD      115200
+// 8N1: start and stop bit for every byte
+#define BYTES_PER_SEC   (BENCH_BAUD / 10)
+
+typedef struct {
+    const char* name;
+    const Profile* profile;
+    const Effect* effect;
+} benchProfile;
+
+static const benchProfile benchProfiles[] = {
+    { "rainbow_flow", &prof_rainbowFlow, 0 },
+    { "rain", &prof_rain, 0 },
+    { "storm", &prof_storm, 0 },
+    { "breathing", &prof_breathing, 0 },
+    { "snowing", &prof_snowing, 0 },
+    { "locked", &prof_locked, 0 },
+    { "stars", &prof_stars, 0 },
+    { "sunny", &prof_sunny, 0 },
+    { "cloudy", &prof_cloudy, 0 },
+    { "weave_effect", 0, &effect_weave_green },
+};
+
+static const char* const formatNames[STREAM_FORMAT_COUNT] = { "rgb888", "rgb565", "rgb332" };
+
+static led_t frames[STREAM_FRAMES][NUM_KEYS];
+static led_t expected[STREAM_FRAMES][NUM_KEYS];
+static uint32_t state[PROFILE_STATE_SIZE / sizeof(uint32_t)];
+
+
+// led_stream.c hooks into the render thread
+void refreshLeds(void) {}
+void requestRender(void) {}
+
+
+static void record(const benchProfile* bench) {
+    const Profile* profile = bench->profile;
+    const Effect* effect = bench->effect;
+    uint8_t fps = profile ? profile->fps : effect->fps;
+    led_t ledColors[NUM_KEYS] = { 0 };
+
+    memset(state, 0, sizeof(state));
+    if (profile && profile->init)
+        profile->init(ledColors, state);
+    if (effect)
+        effect->init(ledColors, state);
+
+    for (int frame = 0; frame < STREAM_FRAMES; frame++) {
+        host_advanceTime(CH_CFG_ST_FREQUENCY / fps);
+
+        if (effect) {
+            if (!effect->tick(state))
+                effect->init(ledColors, state);
+
+            memset(ledColors, 0, sizeof(ledColors));
+            effect->draw(ledColors, state);
+        }
+        else {
+            if (profile->keypress && frame % 8 == 0)
+                profile->keypress(frame % NUM_COLUMN, frame % NUM_ROW, ledColors, state);
+
+            profile->tick(ledColors, state);
+        }
+
+        memcpy(frames[frame], ledColors, sizeof(ledColors));
+    }
+}
+
+
+static void writeKeys(const uint8_t* payload, uint8_t length, void* user) {
+    if (!led_stream_writeKeys(payload, length)) {
+        fprintf(stderr, "packet rejected\n");
+        exit(1);
+    }
+}
+
+/*
+ * Sends the recording through the firmware decoder, returns the average
+ * wire bytes per frame. The raw encoding runs first and what it shows is
+ * what the other encodings must show.
+ */
+static double run(StreamFormat format, int encoding) {
+    streamEncoder encoder;
+    size_t wireBytes = 0;
+
+    stream_encoder_init(&encoder, format);
+    led_stream_setEnabled(true);
+
+    for (int frame = 0; frame < STREAM_FRAMES; frame++) {
+        led_t shown[NUM_KEYS];
+
+        if (encoding < STREAM_ENCODING_COUNT)
+            wireBytes += stream_encodeFrame(&encoder, frames[frame], encoding, writeKeys, 0);
+        else
+            wireBytes += stream_encodeBest(&encoder, frames[frame], writeKeys, 0);
+
+        if (!led_stream_present(shown)) {
+            fprintf(stderr, "frame %d not shown\n", frame);
+            exit(1);
+        }
+
+        if (encoding == STREAM_RAW)
+            memcpy(expected[frame], shown, sizeof(shown));
+        else if (memcmp(expected[frame], shown, sizeof(shown))) {
+            fprintf(stderr, "%s encoding %d: frame %d differs\n", formatNames[format], encoding, frame);
+            exit(1);
+        }
+    }
+
+    led_stream_setEnabled(false);
+    return (double)wireBytes / STREAM_FRAMES;
+}
+
+
+int main(void) {
+    printf("%-14s %-7s %7s %7s %7s %7s  %s\n",
+           "profile", "format", "raw", "delta", "rle", "best", "fps@" "115200 (raw -> best)");
+
+    for (size_t i = 0; i < sizeof(benchProfiles) / sizeof(*benchProfiles); i++) {
+        record(&benchProfiles[i]);
+
+        for (StreamFormat format = STREAM_RGB888; format < STREAM_FORMAT_COUNT; format++) {
+            double bytes[STREAM_ENCODING_COUNT + 1];
+
+            for (int encoding = STREAM_RAW; encoding <= STREAM_ENCODING_COUNT; encoding++)
+                bytes[encoding] = run(format, encoding);
+
+            printf("%-14s %-7s %7.1f %7.1f %7.1f %7.1f  %5.0f -> %5.0f\n",
+                   benchProfiles[i].name, formatNames[format],
+                   bytes[STREAM_RAW], bytes[STREAM_DELTA], bytes[STREAM_RLE], bytes[STREAM_ENCODING_COUNT],
+                   BYTES_PER_SEC / bytes[STREAM_RAW], BYTES_PER_SEC / bytes[STREAM_ENCODING_COUNT]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Generates source/led_gamma.c, the output levels of the LED channels.
+ * Every channel gets its own gamma curve with its white balance gain
+ * folded in, so the frame compile does one table lookup per channel.
+ * The brightness curve scales those levels the way dimming the values
+ * before the lookup would, without their 8-bit steps.
+ * Edit the curves below and run make -C host gamma-table.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "led_gamma.h"
+
+
+typedef struct {
+    const char* name;
+    double gamma;
+    // relative drive of the channel at full white
+    double gain;
+} channelCurve;
+
+// Green is the most efficient die in the package, blue the second.
+static const channelCurve curves[3] = {
+    { "red",   2.2, 1.00 },
+    { "green", 2.2, 0.80 },
+    { "blue",  2.2, 0.90 },
+};
+
+static const double brightnessGamma = 2.2;
+
+
+int main(void) {
+    const double maxLevel = (1 << GAMMA_TABLE_BITS) - 1;
+
+    printf("/*\n");
+    printf(" * Generated by host/gen_gamma.c, do not edit.\n");
+    printf(" * level = ((1 << GAMMA_TABLE_BITS) - 1) * gain * (value / 255) ^ gamma\n");
+    for (int c = 0; c < 3; c++)
+        printf(" *   %-5s  gamma %.2f  gain %.2f\n", curves[c].name, curves[c].gamma, curves[c].gain);
+    printf(" * light = (1 << GAMMA_TABLE_BITS) * (scale / 256) ^ %.2f\n", brightnessGamma);
+    printf(" */\n");
+    printf("#include \"led_gamma.h\"\n\n\n");
+    printf("const uint16_t gammaTable[3][256] = {\n");
+
+    for (int c = 0; c < 3; c++) {
+        printf("    { // %s\n", curves[c].name);
+
+        for (int value = 0; value < 256; value++) {
+            double level = maxLevel * curves[c].gain * pow(value / 255.0, curves[c].gamma);
+
+            if (value % 16 == 0)
+                printf("       ");
+            printf(" %4ld,", lround(level));
+            if (value % 16 == 15)
+                printf("\n");
+        }
+
+        printf("    },\n");
+    }
+
+    printf("};\n\n");
+    printf("const uint16_t brightnessCurve[257] = {\n");
+
+    for (int scale = 0; scale <= 256; scale++) {
+        double light = (maxLevel + 1) * pow(scale / 256.0, brightnessGamma);
+
+        if (scale % 16 == 0)
+            printf("   ");
+        printf(" %4ld,", lround(light));
+        if (scale % 16 == 15 || scale == 256)
+            printf("\n");
+    }
+
+    printf("};\n");
+    return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Golden frames: runs every profile, every weather animation and every
+ * effect on the host build of the firmware (make host) with a seeded
+ * randInt() and the virtual clock, and hashes the frames sent to the
+ * scan (getLedsToDisplay) after every render.
+ *
+ *   golden_frames               prints "case hash ns/frame" per case
+ *   golden_frames --check FILE  compares the hashes with FILE ("case hash"
+ *                               per line, any more columns are ignored),
+ *                               exits 1 if any frame differs or a
+ *                               case of FILE did not run
+ *
+ * host/golden.txt holds the checked-in hashes (make golden-check). A
+ * change that alters frames on purpose updates it (make golden-update).
+ *
+ * A refactor that keeps every hash is pixel identical, the ns/frame
+ * column shows whether it is faster (make golden-compare BASE=<rev>).
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "host_firmware.h"
+#include "common_utils.h"
+
+
+#define GOLDEN_FRAMES   600
+#define GOLDEN_SEED     0x5EED
+#define MAX_CASES       32
+
+typedef struct {
+    char name[24];
+    uint64_t hash;
+    double ns;
+} goldenResult;
+
+static goldenResult results[MAX_CASES];
+static int resultCount = 0;
+
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// FNV-1a
+static uint64_t hashFrame(uint64_t hash, const led_t* leds) {
+    const uint8_t* bytes = (const uint8_t*)leds;
+
+    for (size_t i = 0; i < NUM_KEYS * sizeof(led_t); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+
+/*
+ * Renders GOLDEN_FRAMES frames, pressing a key every 8th frame for the
+ * reactive profiles. With update, the weather data is sent again after
+ * every third of the frames, as the host does while a profile runs.
+ * The render time is measured without the commands.
+ */
+static void runCase(const char* name, const WeatherData* update) {
+    goldenResult* result = &results[resultCount++];
+    uint64_t hash = 0xCBF29CE484222325ull;
+    uint64_t renderNs = 0;
+
+    for (int frame = 0; frame < GOLDEN_FRAMES; frame++) {
+        if (frame % 8 == 0) {
+            uint8_t key = ((frame / 8 % NUM_COLUMN) << 4) | (frame / 8 % NUM_ROW);
+            host_sendCommand(LED_KEY_PRESSED, &key, 1);
+        }
+        if (update && frame && frame % (GOLDEN_FRAMES / 3) == 0)
+            host_sendCommand(LED_UPDATE_WEATHER, update, sizeof(WeatherData));
+
+        uint64_t start = nowNs();
+        host_renderFrame();
+        renderNs += nowNs() - start;
+
+        hash = hashFrame(hash, getLedsToDisplay());
+    }
+
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->hash = hash;
+    result->ns = (double)renderNs / GOLDEN_FRAMES;
+}
+
+static void selectProfile(uint8_t profile) {
+    host_sendCommand(LED_SET_PROFILE, &profile, 1);
+    seedRandInt(GOLDEN_SEED);
+}
+
+
+// profiles[] of led_state.c
+static void runProfiles(uint8_t profileCount) {
+    char name[24];
+
+    for (uint8_t profile = 0; profile < profileCount; profile++) {
+        selectProfile(profile);
+        snprintf(name, sizeof(name), "profile_%u", profile);
+        runCase(name, NULL);
+    }
+}
+
+
+// The live weather profile plays each weather animation for matching weather data.
+static void runWeather(uint8_t profileCount) {
+    static const struct {
+        const char* name;
+        WeatherData weather;
+    } weathers[] = {
+        { "weather_cloudy", { .time = { 12, 0, 0 }, .sunriseTime = { 6, 0, 0 }, .sunsetTime = { 20, 0, 0 }, .cloudDensity = 60 } },
+        { "weather_stars",  { .time = { 23, 0, 0 }, .sunriseTime = { 6, 0, 0 }, .sunsetTime = { 20, 0, 0 } } },
+        { "weather_rain",   { .time = { 12, 0, 0 }, .sunriseTime = { 6, 0, 0 }, .sunsetTime = { 20, 0, 0 }, .rainIntensity = 70 } },
+        { "weather_storm",  { .time = { 12, 0, 0 }, .sunriseTime = { 6, 0, 0 }, .sunsetTime = { 20, 0, 0 }, .rainIntensity = 80, .stormIntensity = 50 } },
+        { "weather_snow",   { .time = { 12, 0, 0 }, .sunriseTime = { 6, 0, 0 }, .sunsetTime = { 20, 0, 0 }, .snowIntensity = 60 } },
+    };
+
+    uint8_t liveWeather = 0;
+    while (liveWeather < profileCount) {
+        host_sendCommand(LED_SET_PROFILE, &liveWeather, 1);
+        if (getCurrentProfile() == &prof_liveWeather)
+            break;
+        liveWeather++;
+    }
+    if (liveWeather == profileCount)
+        return;
+
+    for (size_t i = 0; i < LEN(weathers); i++) {
+        host_sendCommand(LED_UPDATE_WEATHER, &weathers[i].weather, sizeof(WeatherData));
+        selectProfile(liveWeather);
+        runCase(weathers[i].name, NULL);
+    }
+
+    // updates while an animation runs change its intensity, not restart it
+    static const WeatherData heavierRain = {
+        .time = { 12, 0, 0 }, .sunriseTime = { 6, 0, 0 }, .sunsetTime = { 20, 0, 0 }, .rainIntensity = 90
+    };
+    host_sendCommand(LED_UPDATE_WEATHER, &weathers[2].weather, sizeof(WeatherData));
+    selectProfile(liveWeather);
+    runCase("weather_rain_update", &heavierRain);
+}
+
+
+// effects[] of led_state.c, started by the power plan changes
+static void runEffects(void) {
+    static const char* const names[] = { "effect_weave_green", "effect_weave_yellow", "effect_weave_red" };
+
+    for (uint8_t plan = POWER_BATT; plan <= POWER_MAX; plan++) {
+        selectProfile(0);
+        host_sendCommand(LED_SET_POWER_PLAN, &plan, 1);
+        runCase(names[plan], NULL);
+    }
+}
+
+
+static int check(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+
+    char name[24];
+    uint64_t hash;
+    int failures = 0, checked = 0;
+
+    // the ns/frame column of a saved golden run is skipped
+    while (fscanf(file, "%23s %" SCNx64 "%*[^\n]", name, &hash) == 2) {
+        bool found = false;
+
+        for (int i = 0; i < resultCount; i++) {
+            if (strcmp(results[i].name, name))
+                continue;
+
+            found = true;
+            if (results[i].hash != hash) {
+                printf("%-20s differs: %016" PRIx64 " expected %016" PRIx64 "\n", name, results[i].hash, hash);
+                failures++;
+            }
+        }
+
+        // a dropped or renamed case fails too
+        if (!found) {
+            printf("%-20s missing from this run\n", name);
+            failures++;
+        }
+        checked++;
+    }
+    fclose(file);
+
+    printf("%d of %d cases identical\n", checked - failures, checked);
+    return failures || !checked;
+}
+
+
+int main(int argc, char** argv) {
+    host_boot();
+
+    uint8_t profileCount;
+    host_sendCommand(LED_GET_PROFILE_COUNT, NULL, 0);
+    if (host_takeReply(&profileCount) != 1) {
+        fprintf(stderr, "no LED_GET_PROFILE_COUNT reply\n");
+        return 1;
+    }
+
+    runProfiles(profileCount);
+    runWeather(profileCount);
+    runEffects();
+
+    if (argc == 3 && !strcmp(argv[1], "--check"))
+        return check(argv[2]);
+
+    for (int i = 0; i < resultCount; i++)
+        printf("%-20s %016" PRIx64 " %8.1f\n", results[i].name, results[i].hash, results[i].ns);
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <string.h>
+
+#include "host_firmware.h"
+#include "common_utils.h"
+#include "led_multiplexing.h"
+#include "perf_stats.h"
+
+
+// The serial loop of main.c, until the received bytes run out.
+static void pumpSerial(void) {
+    msg_t msg;
+    while ((msg = sdGetTimeout(&SD1, TIME_IMMEDIATE)) >= MSG_OK) {
+        main_comm_processByte((uint8_t)msg);
+        main_comm_update();
+    }
+    main_comm_update();
+}
+
+
+void host_boot(void) {
+    main_comm_init();
+    perf_init();
+    led_anim_init();
+    led_multiplexing_init();
+
+    host_sendCommand(LED_MAIN_INIT_DONE, NULL, 0);
+    host_sendCommand(LED_TOGGLE, NULL, 0);
+}
+
+
+void host_sendCommand(uint8_t opcode, const void* payload, uint8_t length) {
+    uint8_t header[4] = { COMM_FRAME_START, COMM_VERSION, opcode, length };
+    uint8_t crc = crc8(crc8(0, &header[1], 3), payload, length);
+
+    host_serialReceive(header, sizeof(header));
+    host_serialReceive(payload, length);
+    host_serialReceive(&crc, 1);
+    pumpSerial();
+}
+
+int host_takeReply(uint8_t* payload) {
+    uint8_t frame[COMM_MAX_PAYLOAD + 5];
+    size_t length = host_serialTake(frame, sizeof(frame));
+
+    if (length < 5 || frame[0] != COMM_FRAME_START || frame[3] + 5u != length ||
+        crc8(0, &frame[1], length - 2) != frame[length - 1])
+        return -1;
+
+    memcpy(payload, &frame[4], frame[3]);
+    return frame[3];
+}
+
+
+void host_renderFrame(void) {
+    host_advanceTime(CH_CFG_ST_FREQUENCY / HOST_ANIMATION_FPS);
+    host_fireTimer(&GPTD_BFTM1);
+}
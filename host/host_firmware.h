@@ -0,0 +1,23 @@
+#pragma once
+
+#include "hal.h"
+#include "led_state.h"
+#include "main_comm.h"
+
+
+/*
+ * Helpers for host programs that run the whole firmware (make host):
+ * booting it, talking to it over the fake SD1 and rendering frames on
+ * the virtual clock.
+ */
+#define HOST_ANIMATION_FPS 60
+
+// Starts the firmware like main.c, with the LEDs on and main init done.
+void host_boot(void);
+
+void host_sendCommand(uint8_t opcode, const void* payload, uint8_t length);
+// Returns the payload length of the next framed reply, or -1 without a valid one.
+int host_takeReply(uint8_t* payload);
+
+// Advances the virtual clock by one animation timer period and renders.
+void host_renderFrame(void);
@@ -0,0 +1,133 @@
+/*
+ * Minimal ChibiOS/RT stand-in for building the firmware on a host.
+ * System time is a virtual clock that only moves when the host program
+ * advances it.
+ *
+ * Threads are real pthreads, but only one runs at a time: like the RT
+ * scheduler, the highest priority ready thread runs until it blocks. The
+ * host program's own thread is the ChibiOS main thread.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define CH_CFG_ST_FREQUENCY 10000
+#define CH_DBG_STACK_FILL_VALUE 0x55
+
+typedef uint32_t systime_t;
+typedef uint32_t sysinterval_t;
+typedef int32_t msg_t;
+typedef uint32_t tprio_t;
+typedef uint32_t eventmask_t;
+typedef uint32_t eventflags_t;
+typedef uint64_t stkalign_t;
+
+#define MSG_OK       0
+#define MSG_TIMEOUT  -1
+
+#define NORMALPRIO  128
+
+#define TIME_IMMEDIATE  ((sysinterval_t)0)
+#define TIME_INFINITE   ((sysinterval_t)-1)
+#define TIME_MS2I(ms)   ((sysinterval_t)((ms) * (CH_CFG_ST_FREQUENCY / 1000)))
+#define TIME_US2I(us)   ((sysinterval_t)((us) / (1000000 / CH_CFG_ST_FREQUENCY)))
+#define TIME_I2MS(t)    ((t) / (CH_CFG_ST_FREQUENCY / 1000))
+
+
+//// Threads ////
+
+typedef struct host_thread thread_t;
+
+struct host_thread {
+    void* wabase;
+    tprio_t prio;
+    int state;
+    eventmask_t pending;
+    eventmask_t waitMask;
+    void (*function)(void*);
+    void* arg;
+    pthread_t pthread;
+    thread_t* next;
+};
+
+#define THD_WORKING_AREA(name, size) stkalign_t name[((size) + sizeof(stkalign_t) - 1) / sizeof(stkalign_t)]
+#define THD_FUNCTION(name, arg) void name(void* arg)
+
+thread_t* chThdCreateStatic(void* wsp, size_t size, tprio_t prio, void (*function)(void*), void* arg);
+thread_t* chThdGetSelfX(void);
+void chThdSleepMilliseconds(uint32_t ms);
+
+thread_t* chRegFirstThread(void);
+thread_t* chRegNextThread(thread_t* tp);
+
+// Nothing preempts a running thread, so critical sections need no lock.
+static inline void chSysLock(void) {}
+static inline void chSysUnlock(void) {}
+static inline void chSysLockFromISR(void) {}
+static inline void chSysUnlockFromISR(void) {}
+
+//// ////
+
+
+//// Events ////
+
+#define EVENT_MASK(eid) ((eventmask_t)1 << (eventmask_t)(eid))
+#define ALL_EVENTS      ((eventmask_t)-1)
+
+typedef struct {
+    eventflags_t flags;
+    eventflags_t wanted;
+} event_listener_t;
+
+typedef struct {
+    event_listener_t* listener;
+} event_source_t;
+
+eventmask_t chEvtWaitAny(eventmask_t mask);
+void chEvtSignal(thread_t* tp, eventmask_t mask);
+void chEvtSignalI(thread_t* tp, eventmask_t mask);
+void chEvtRegisterMaskWithFlags(event_source_t* esp, event_listener_t* elp, eventmask_t mask, eventflags_t wflags);
+eventflags_t chEvtGetAndClearFlags(event_listener_t* elp);
+void chEvtBroadcastFlagsI(event_source_t* esp, eventflags_t flags);
+
+//// ////
+
+
+//// Mutexes ////
+
+typedef struct {
+    thread_t* owner;
+} mutex_t;
+
+#define MUTEX_DECL(name) mutex_t name = { 0 }
+
+void chMtxLock(mutex_t* mp);
+void chMtxUnlock(mutex_t* mp);
+
+//// ////
+
+
+//// Virtual Timers ////
+
+typedef void (*vtfunc_t)(void* arg);
+
+typedef struct {
+    bool armed;
+    systime_t deadline;
+    vtfunc_t function;
+    void* arg;
+} virtual_timer_t;
+
+systime_t chVTGetSystemTime(void);
+systime_t chVTGetSystemTimeX(void);
+void chVTSet(virtual_timer_t* vtp, sysinterval_t delay, vtfunc_t function, void* arg);
+void chVTSetI(virtual_timer_t* vtp, sysinterval_t delay, vtfunc_t function, void* arg);
+
+// Moves the virtual clock, firing the virtual timers that come due.
+void host_advanceTime(sysinterval_t ticks);
+
+//// ////
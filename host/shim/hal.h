@@ -0,0 +1,129 @@
+/*
+ * Minimal ChibiOS HAL stand-in for host builds, see ch.h.
+ * Ports are plain variables, timers only fire when the host program
+ * fires them and SD1 reads from / writes to host side buffers.
+ */
+#pragma once
+
+#include "ch.h"
+
+
+//// PAL ////
+
+typedef uint32_t ioline_t;
+typedef uint32_t ioportid_t;
+
+#define PAL_LINE(port, pad) ((ioline_t)(((port) << 4) | (pad)))
+#define PAL_PORT(line)      ((ioportid_t)((line) >> 4))
+#define PAL_PAD(line)       ((line) & 0xF)
+#define IOPORTA 0
+#define IOPORTB 1
+#define IOPORTC 2
+#define IOPORTD 3
+
+extern uint16_t host_ports[4];
+
+#define palSetPort(port, bits)      (host_ports[port] |= (bits))
+#define palClearPort(port, bits)    (host_ports[port] &= ~(bits))
+#define palSetLine(line)            palSetPort(PAL_PORT(line), 1 << PAL_PAD(line))
+#define palClearLine(line)          palClearPort(PAL_PORT(line), 1 << PAL_PAD(line))
+
+//// ////
+
+
+//// GPT ////
+
+typedef struct GPTDriver GPTDriver;
+typedef void (*gptcallback_t)(GPTDriver* gptp);
+
+typedef struct {
+    uint32_t frequency;
+    gptcallback_t callback;
+} GPTConfig;
+
+struct GPTDriver {
+    const GPTConfig* config;
+    uint32_t interval;
+    bool running;
+};
+
+extern GPTDriver GPTD_BFTM0;
+extern GPTDriver GPTD_BFTM1;
+
+void gptStart(GPTDriver* gptp, const GPTConfig* config);
+void gptStartContinuous(GPTDriver* gptp, uint32_t interval);
+void gptStopTimer(GPTDriver* gptp);
+void gptChangeIntervalI(GPTDriver* gptp, uint32_t interval);
+
+// Runs the timer's callback as its interrupt would, if the timer is running.
+void host_fireTimer(GPTDriver* gptp);
+
+//// ////
+
+
+//// Serial ////
+
+#define SD_PARITY_ERROR     32
+#define SD_FRAMING_ERROR    64
+#define SD_OVERRUN_ERROR    128
+#define SD_NOISE_ERROR      256
+#define SD_BREAK_DETECTED   512
+#define SD_QUEUE_FULL_ERROR 1024
+
+typedef struct {
+    uint32_t speed;
+} SerialConfig;
+
+typedef struct {
+    int unused;
+} output_queue_t;
+
+typedef struct {
+    output_queue_t oqueue;
+    event_source_t event;
+    const SerialConfig* config;
+} SerialDriver;
+
+extern SerialDriver SD1;
+
+// everything written is sent at once
+#define oqIsEmptyI(oqp)         ((void)(oqp), true)
+#define chnGetEventSource(ip)   (&(ip)->event)
+
+void sdStart(SerialDriver* sdp, const SerialConfig* config);
+void sdStop(SerialDriver* sdp);
+size_t sdWrite(SerialDriver* sdp, const uint8_t* bp, size_t n);
+msg_t sdGetTimeout(SerialDriver* sdp, sysinterval_t timeout);
+
+// Bytes for sdGetTimeout, as if the main MCU had sent them.
+void host_serialReceive(const uint8_t* data, size_t length);
+// Takes what the firmware has written to SD1, returns the byte count.
+size_t host_serialTake(uint8_t* buffer, size_t size);
+
+//// ////
+
+
+//// Cortex-M ////
+
+typedef struct {
+    volatile uint32_t CTRL, LOAD, VAL, CALIB;
+} SysTick_Type;
+
+typedef struct {
+    volatile uint32_t CPUID, ICSR, VTOR, AIRCR, SCR;
+} SCB_Type;
+
+extern SysTick_Type host_sysTick;
+extern SCB_Type host_scb;
+
+#define SysTick (&host_sysTick)
+#define SCB     (&host_scb)
+#define SCB_ICSR_PENDSTSET_Msk (1UL << 26)
+
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline void __WFI(void) {}
+
+void NVIC_SystemReset(void);
+
+//// ////
@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+
+
+//// Clock ////
+
+#define MAX_VIRTUAL_TIMERS 8
+
+static systime_t systemTime = 0;
+static virtual_timer_t* virtualTimers[MAX_VIRTUAL_TIMERS];
+
+systime_t chVTGetSystemTime() {
+    return systemTime;
+}
+
+systime_t chVTGetSystemTimeX() {
+    return systemTime;
+}
+
+void chVTSetI(virtual_timer_t* vtp, sysinterval_t delay, vtfunc_t function, void* arg) {
+    vtp->armed = true;
+    vtp->deadline = systemTime + delay;
+    vtp->function = function;
+    vtp->arg = arg;
+
+    for (int i = 0; i < MAX_VIRTUAL_TIMERS; i++) {
+        if (virtualTimers[i] == vtp)
+            return;
+    }
+    for (int i = 0; i < MAX_VIRTUAL_TIMERS; i++) {
+        if (!virtualTimers[i]) {
+            virtualTimers[i] = vtp;
+            return;
+        }
+    }
+
+    fprintf(stderr, "host shim: too many virtual timers\n");
+    abort();
+}
+
+void chVTSet(virtual_timer_t* vtp, sysinterval_t delay, vtfunc_t function, void* arg) {
+    chVTSetI(vtp, delay, function, arg);
+}
+
+void host_advanceTime(sysinterval_t ticks) {
+    systime_t target = systemTime + ticks;
+
+    // fire the due timers in deadline order, with the clock at their deadline
+    while (true) {
+        virtual_timer_t* next = NULL;
+
+        for (int i = 0; i < MAX_VIRTUAL_TIMERS; i++) {
+            virtual_timer_t* vtp = virtualTimers[i];
+            if (vtp && vtp->armed && vtp->deadline - systemTime <= target - systemTime &&
+                (!next || vtp->deadline - systemTime < next->deadline - systemTime))
+                next = vtp;
+        }
+
+        if (!next)
+            break;
+
+        systemTime = next->deadline;
+        next->armed = false;
+        next->function(next->arg);
+    }
+
+    systemTime = target;
+}
+
+//// ////
+
+
+//// Scheduler ////
+/*
+ * Every thread holds bigLock while it runs and waits on switchCond until
+ * it is the current thread again, so the pthreads take turns exactly like
+ * threads on a single core.
+ */
+enum { THREAD_READY, THREAD_WAIT_EVENTS, THREAD_WAIT_MUTEX };
+
+static pthread_mutex_t bigLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t switchCond = PTHREAD_COND_INITIALIZER;
+
+static uint8_t mainWorkingArea[256];
+static thread_t mainThread = { .wabase = mainWorkingArea, .prio = NORMALPRIO, .state = THREAD_READY };
+static thread_t* currentThread = &mainThread;
+static thread_t* registry = &mainThread;
+
+
+static void fillWorkingArea(void* wsp, size_t size) {
+    // the top of a working area holds the thread, it is never free stack
+    memset(wsp, CH_DBG_STACK_FILL_VALUE, size - sizeof(stkalign_t));
+    memset((uint8_t*)wsp + size - sizeof(stkalign_t), 0, sizeof(stkalign_t));
+}
+
+__attribute__((constructor))
+static void schedulerInit(void) {
+    fillWorkingArea(mainWorkingArea, sizeof(mainWorkingArea));
+    pthread_mutex_lock(&bigLock);
+}
+
+
+static void reschedule(void) {
+    thread_t* self = currentThread;
+    thread_t* next = self->state == THREAD_READY ? self : NULL;
+
+    for (thread_t* tp = registry; tp; tp = tp->next) {
+        if (tp->state == THREAD_READY && (!next || tp->prio > next->prio))
+            next = tp;
+    }
+
+    if (!next) {
+        fprintf(stderr, "host shim: every thread is blocked\n");
+        abort();
+    }
+
+    if (next == self)
+        return;
+
+    currentThread = next;
+    pthread_cond_broadcast(&switchCond);
+    while (currentThread != self)
+        pthread_cond_wait(&switchCond, &bigLock);
+}
+
+static void* threadEntry(void* arg) {
+    thread_t* self = arg;
+
+    pthread_mutex_lock(&bigLock);
+    while (currentThread != self)
+        pthread_cond_wait(&switchCond, &bigLock);
+
+    self->function(self->arg);
+
+    fprintf(stderr, "host shim: thread function returned\n");
+    abort();
+}
+
+thread_t* chThdCreateStatic(void* wsp, size_t size, tprio_t prio, void (*function)(void*), void* arg) {
+    thread_t* tp = calloc(1, sizeof(thread_t));
+    thread_t** last = &registry;
+
+    fillWorkingArea(wsp, size);
+    tp->wabase = wsp;
+    tp->prio = prio;
+    tp->state = THREAD_READY;
+    tp->function = function;
+    tp->arg = arg;
+
+    while (*last)
+        last = &(*last)->next;
+    *last = tp;
+
+    pthread_create(&tp->pthread, NULL, threadEntry, tp);
+    reschedule();
+    return tp;
+}
+
+thread_t* chThdGetSelfX() {
+    return currentThread;
+}
+
+void chThdSleepMilliseconds(uint32_t ms) {
+    host_advanceTime(TIME_MS2I(ms));
+}
+
+thread_t* chRegFirstThread() {
+    return registry;
+}
+
+thread_t* chRegNextThread(thread_t* tp) {
+    return tp->next;
+}
+
+//// ////
+
+
+//// Events ////
+
+eventmask_t chEvtWaitAny(eventmask_t mask) {
+    thread_t* self = currentThread;
+
+    while (!(self->pending & mask)) {
+        self->waitMask = mask;
+        self->state = THREAD_WAIT_EVENTS;
+        reschedule();
+    }
+
+    eventmask_t events = self->pending & mask;
+    self->pending &= ~events;
+    return events;
+}
+
+void chEvtSignalI(thread_t* tp, eventmask_t mask) {
+    tp->pending |= mask;
+    if (tp->state == THREAD_WAIT_EVENTS && (tp->pending & tp->waitMask))
+        tp->state = THREAD_READY;
+
+    // on the target the woken thread runs when the ISR returns
+    reschedule();
+}
+
+void chEvtSignal(thread_t* tp, eventmask_t mask) {
+    chEvtSignalI(tp, mask);
+}
+
+void chEvtRegisterMaskWithFlags(event_source_t* esp, event_listener_t* elp, eventmask_t mask, eventflags_t wflags) {
+    (void)mask;
+
+    elp->flags = 0;
+    elp->wanted = wflags;
+    esp->listener = elp;
+}
+
+eventflags_t chEvtGetAndClearFlags(event_listener_t* elp) {
+    eventflags_t flags = elp->flags;
+    elp->flags = 0;
+    return flags;
+}
+
+void chEvtBroadcastFlagsI(event_source_t* esp, eventflags_t flags) {
+    if (esp->listener)
+        esp->listener->flags |= flags & esp->listener->wanted;
+}
+
+//// ////
+
+
+//// Mutexes ////
+
+void chMtxLock(mutex_t* mp) {
+    thread_t* self = currentThread;
+
+    while (mp->owner && mp->owner != self) {
+        self->state = THREAD_WAIT_MUTEX;
+        reschedule();
+    }
+
+    mp->owner = self;
+}
+
+void chMtxUnlock(mutex_t* mp) {
+    mp->owner = NULL;
+
+    // the waiters retry, the highest priority one gets it
+    for (thread_t* tp = registry; tp; tp = tp->next) {
+        if (tp->state == THREAD_WAIT_MUTEX)
+            tp->state = THREAD_READY;
+    }
+
+    reschedule();
+}
+
+//// ////
+
+
+//// HAL ////
+
+uint16_t host_ports[4];
+
+GPTDriver GPTD_BFTM0;
+GPTDriver GPTD_BFTM1;
+
+void gptStart(GPTDriver* gptp, const GPTConfig* config) {
+    gptp->config = config;
+}
+
+void gptStartContinuous(GPTDriver* gptp, uint32_t interval) {
+    gptp->interval = interval;
+    gptp->running = true;
+}
+
+void gptStopTimer(GPTDriver* gptp) {
+    gptp->running = false;
+}
+
+void gptChangeIntervalI(GPTDriver* gptp, uint32_t interval) {
+    gptp->interval = interval;
+}
+
+void host_fireTimer(GPTDriver* gptp) {
+    if (gptp->running && gptp->config && gptp->config->callback)
+        gptp->config->callback(gptp);
+}
+
+
+#define SERIAL_BUFFER_SIZE 4096
+
+SerialDriver SD1;
+
+static uint8_t serialIn[SERIAL_BUFFER_SIZE];
+static size_t serialInHead = 0, serialInTail = 0;
+static uint8_t serialOut[SERIAL_BUFFER_SIZE];
+static size_t serialOutLength = 0;
+
+void sdStart(SerialDriver* sdp, const SerialConfig* config) {
+    sdp->config = config;
+}
+
+void sdStop(SerialDriver* sdp) {
+    sdp->config = NULL;
+}
+
+size_t sdWrite(SerialDriver* sdp, const uint8_t* bp, size_t n) {
+    (void)sdp;
+
+    if (n > SERIAL_BUFFER_SIZE - serialOutLength) {
+        chEvtBroadcastFlagsI(&SD1.event, SD_QUEUE_FULL_ERROR);
+        n = SERIAL_BUFFER_SIZE - serialOutLength;
+    }
+
+    memcpy(&serialOut[serialOutLength], bp, n);
+    serialOutLength += n;
+    return n;
+}
+
+msg_t sdGetTimeout(SerialDriver* sdp, sysinterval_t timeout) {
+    (void)sdp;
+    (void)timeout;
+
+    if (serialInTail == serialInHead)
+        return MSG_TIMEOUT;
+
+    return serialIn[serialInTail++ % SERIAL_BUFFER_SIZE];
+}
+
+void host_serialReceive(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (serialInHead - serialInTail == SERIAL_BUFFER_SIZE) {
+            chEvtBroadcastFlagsI(&SD1.event, SD_QUEUE_FULL_ERROR);
+            return;
+        }
+        serialIn[serialInHead++ % SERIAL_BUFFER_SIZE] = data[i];
+    }
+}
+
+size_t host_serialTake(uint8_t* buffer, size_t size) {
+    size_t n = serialOutLength < size ? serialOutLength : size;
+
+    memcpy(buffer, serialOut, n);
+    memmove(serialOut, &serialOut[n], serialOutLength - n);
+    serialOutLength -= n;
+    return n;
+}
+
+
+// 48 MHz core, SysTick reloads every system tick
+SysTick_Type host_sysTick = { .LOAD = 48000000 / CH_CFG_ST_FREQUENCY - 1, .VAL = 48000000 / CH_CFG_ST_FREQUENCY - 1 };
+SCB_Type host_scb;
+
+void NVIC_SystemReset(void) {
+    fprintf(stderr, "host shim: system reset\n");
+    exit(0);
+}
+
+//// ////
@@ -0,0 +1,75 @@
+/*
+ * Runs the whole firmware on the host: boots it like main.c, drives it
+ * with serial commands and renders frames from the 60 Hz animation timer
+ * on the virtual clock. For every profile the wall time per frame of the
+ * complete render path (profile, compositor, frame compile) is reported
+ * in ns, then the stats the firmware itself reports over LED_GET_STATS.
+ * The times include two switches to and from the render thread, which
+ * cost a few us on the shim.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "host_firmware.h"
+
+
+#define HOST_FRAMES 3000
+
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+static double runProfile(uint8_t profile) {
+    host_sendCommand(LED_SET_PROFILE, &profile, 1);
+
+    uint64_t start = nowNs();
+    for (int frame = 0; frame < HOST_FRAMES; frame++) {
+        // breathing only lights pressed keys
+        if (frame % 8 == 0) {
+            uint8_t key = ((frame / 8 % NUM_COLUMN) << 4) | (frame / 8 % NUM_ROW);
+            host_sendCommand(LED_KEY_PRESSED, &key, 1);
+        }
+
+        host_renderFrame();
+    }
+
+    return (double)(nowNs() - start) / HOST_FRAMES;
+}
+
+
+static void printStats(void) {
+    uint8_t stats[COMM_MAX_PAYLOAD];
+
+    host_sendCommand(LED_GET_STATS, NULL, 0);
+    if (host_takeReply(stats) < 22) {
+        fprintf(stderr, "no LED_GET_STATS reply\n");
+        return;
+    }
+
+    printf("parse errors %u, dropped key events %u, render overruns %u, dropped frames %u\n",
+           stats[18] | (stats[19] << 8), stats[20] | (stats[21] << 8),
+           stats[10] | (stats[11] << 8), stats[12] | (stats[13] << 8));
+}
+
+
+int main(void) {
+    host_boot();
+
+    uint8_t profileCount;
+    host_sendCommand(LED_GET_PROFILE_COUNT, NULL, 0);
+    if (host_takeReply(&profileCount) != 1) {
+        fprintf(stderr, "no LED_GET_PROFILE_COUNT reply\n");
+        return 1;
+    }
+
+    for (uint8_t profile = 0; profile < profileCount; profile++)
+        printf("profile_%-8u %8.1f\n", profile, runProfile(profile));
+
+    printStats();
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include <string.h>
+
+#include "stream_encode.h"
+
+
+static const uint8_t bytesPerKey[STREAM_FORMAT_COUNT] = {
+    [STREAM_RGB888] = 3,
+    [STREAM_RGB565] = 2,
+    [STREAM_RGB332] = 1,
+};
+
+
+void stream_encoder_init(streamEncoder* encoder, StreamFormat format) {
+    // the keyboard clears its staging frame when streaming starts
+    memset(encoder, 0, sizeof(*encoder));
+    encoder->format = format;
+}
+
+
+// Packing is one to one with what the keyboard decodes, so equal packed
+// colors are equal on the keyboard.
+static void packKey(StreamFormat format, const led_t* color, uint8_t* out) {
+    switch (format) {
+    case STREAM_RGB565: {
+        uint16_t value = ((color->red >> 3) << 11) | ((color->green >> 2) << 5) | (color->blue >> 3);
+        out[0] = value & 0xFF;
+        out[1] = value >> 8;
+        break;
+    }
+
+    case STREAM_RGB332:
+        out[0] = (color->red & 0xE0) | ((color->green >> 5) << 2) | (color->blue >> 6);
+        break;
+
+    case STREAM_RGB888:
+    default:
+        out[0] = color->red;
+        out[1] = color->green;
+        out[2] = color->blue;
+        break;
+    }
+}
+
+
+//// Packet Builder ////
+/*
+ * Frames too large for one packet are split, every packet starts with
+ * the format byte and its own header, only the last one shows the frame.
+ */
+typedef struct {
+    uint8_t payload[STREAM_MAX_PAYLOAD];
+    uint8_t length;
+    uint8_t formatByte;
+    size_t wireBytes;
+    streamEmit emit;
+    void* user;
+} packetBuilder;
+
+static void builder_init(packetBuilder* builder, StreamFormat format, StreamEncoding encoding,
+                         streamEmit emit, void* user) {
+    builder->formatByte = format | (encoding << STREAM_ENCODING_SHIFT);
+    builder->length = 0;
+    builder->wireBytes = 0;
+    builder->emit = emit;
+    builder->user = user;
+}
+
+static void builder_flush(packetBuilder* builder, bool show) {
+    if (!builder->length)
+        return;
+
+    if (show)
+        builder->payload[0] |= STREAM_SHOW_FLAG;
+
+    if (builder->emit)
+        builder->emit(builder->payload, builder->length, builder->user);
+
+    builder->wireBytes += builder->length + STREAM_FRAME_OVERHEAD;
+    builder->length = 0;
+}
+
+// Starts a new packet if size more bytes do not fit, returns true if it did.
+static bool builder_reserve(packetBuilder* builder, uint8_t size) {
+    if (builder->length && builder->length + size <= STREAM_MAX_PAYLOAD)
+        return false;
+
+    builder_flush(builder, false);
+    builder->payload[builder->length++] = builder->formatByte;
+    return true;
+}
+
+static void builder_append(packetBuilder* builder, const uint8_t* data, uint8_t size) {
+    memcpy(&builder->payload[builder->length], data, size);
+    builder->length += size;
+}
+
+//// ////
+
+
+static size_t encodeRaw(streamEncoder* encoder, const uint8_t packed[][3], packetBuilder* builder) {
+    uint8_t step = bytesPerKey[encoder->format];
+
+    for (uint8_t key = 0; key < NUM_KEYS; key++) {
+        if (builder_reserve(builder, step))
+            builder_append(builder, &key, 1);
+        builder_append(builder, packed[key], step);
+    }
+
+    builder_flush(builder, true);
+    return builder->wireBytes;
+}
+
+static size_t encodeDelta(streamEncoder* encoder, const uint8_t packed[][3], packetBuilder* builder) {
+    uint8_t step = bytesPerKey[encoder->format];
+    uint8_t bitmap[STREAM_BITMAP_SIZE] = { 0 };
+
+    // a full frame always fits: 1 + STREAM_BITMAP_SIZE + NUM_KEYS * 3 bytes
+    builder_reserve(builder, STREAM_BITMAP_SIZE);
+    builder_append(builder, bitmap, STREAM_BITMAP_SIZE);
+
+    for (uint8_t key = 0; key < NUM_KEYS; key++) {
+        if (memcmp(packed[key], encoder->sent[key], step)) {
+            builder->payload[1 + (key >> 3)] |= 1 << (key & 7);
+            builder_append(builder, packed[key], step);
+        }
+    }
+
+    builder_flush(builder, true);
+    return builder->wireBytes;
+}
+
+static size_t encodeRle(streamEncoder* encoder, const uint8_t packed[][3], packetBuilder* builder) {
+    uint8_t step = bytesPerKey[encoder->format];
+    uint8_t key = 0;
+
+    while (key < NUM_KEYS) {
+        uint8_t count = 1;
+        while (key + count < NUM_KEYS && count < 255 && !memcmp(packed[key], packed[key + count], step))
+            count++;
+
+        if (builder_reserve(builder, step + 1))
+            builder_append(builder, &key, 1);
+        builder_append(builder, &count, 1);
+        builder_append(builder, packed[key], step);
+
+        key += count;
+    }
+
+    builder_flush(builder, true);
+    return builder->wireBytes;
+}
+
+
+size_t stream_encodeFrame(streamEncoder* encoder, const led_t* frame,
+                          StreamEncoding encoding, streamEmit emit, void* user) {
+    uint8_t packed[NUM_KEYS][3];
+    packetBuilder builder;
+    size_t wireBytes = 0;
+
+    for (uint8_t key = 0; key < NUM_KEYS; key++)
+        packKey(encoder->format, &frame[key], packed[key]);
+
+    builder_init(&builder, encoder->format, encoding, emit, user);
+
+    switch (encoding) {
+    case STREAM_RAW:
+        wireBytes = encodeRaw(encoder, packed, &builder);
+        break;
+
+    case STREAM_DELTA:
+        wireBytes = encodeDelta(encoder, packed, &builder);
+        break;
+
+    case STREAM_RLE:
+        wireBytes = encodeRle(encoder, packed, &builder);
+        break;
+
+    default:
+        return 0;
+    }
+
+    // only a frame that was sent is on the keyboard
+    if (emit)
+        memcpy(encoder->sent, packed, sizeof(packed));
+
+    return wireBytes;
+}
+
+size_t stream_encodeBest(streamEncoder* encoder, const led_t* frame,
+                         streamEmit emit, void* user) {
+    StreamEncoding best = STREAM_RAW;
+    size_t bestBytes = SIZE_MAX;
+
+    for (StreamEncoding encoding = STREAM_RAW; encoding < STREAM_ENCODING_COUNT; encoding++) {
+        size_t bytes = stream_encodeFrame(encoder, frame, encoding, 0, 0);
+        if (bytes < bestBytes) {
+            best = encoding;
+            bestBytes = bytes;
+        }
+    }
+
+    return stream_encodeFrame(encoder, frame, best, emit, user);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "led_stream.h"
+
+
+/*
+ * Host side encoder of LED_STREAM_KEYS packets.
+ * The encoder remembers the last frame it sent, which is what the
+ * keyboard's staging frame holds, to send only the changed keys.
+ */
+#define STREAM_MAX_PAYLOAD      255
+// COMM_FRAME_START, version, opcode, length and the CRC
+#define STREAM_FRAME_OVERHEAD   5
+
+// called with the payload of every LED_STREAM_KEYS packet of a frame
+typedef void (*streamEmit)(const uint8_t* payload, uint8_t length, void* user);
+
+typedef struct {
+    StreamFormat format;
+    uint8_t sent[NUM_KEYS][3];
+} streamEncoder;
+
+void stream_encoder_init(streamEncoder* encoder, StreamFormat format);
+
+// Returns the bytes the frame takes on the wire, emit may be 0 to only count them.
+size_t stream_encodeFrame(streamEncoder* encoder, const led_t* frame,
+                          StreamEncoding encoding, streamEmit emit, void* user);
+
+// Encodes with whichever encoding is the smallest for this frame.
+size_t stream_encodeBest(streamEncoder* encoder, const led_t* frame,
+                         streamEmit emit, void* user);
@@ -19,31 +19,30 @@
 #include "led_animation.h"
 #include "led_multiplexing.h"
 #include "main_comm.h"
-
-
-static const SerialConfig usart1Config = {
-    .speed = 115200
-};
+#include "perf_stats.h"
 
 
 int main(void) {
     halInit();
     chSysInit();
 
-    sdStart(&SD1, &usart1Config);
+    main_comm_init();
 
     palClearLine(LINE_LED_PWR);
 
+    perf_init();
+
     led_anim_init();
     led_multiplexing_init();
 
     palSetLine(LINE_LED_PWR);
 
     while (true) {
-        msg_t msg;	
-        msg = sdGet(&SD1);	
-        if(msg >= MSG_OK){	
-            main_comm_executeMsg(msg);	
+        msg_t msg;
+        msg = sdGetTimeout(&SD1, main_comm_getPollTimeout());
+        if(msg >= MSG_OK){
+            main_comm_processByte((uint8_t)msg);
         }
+        main_comm_update();
     }
 }
@@ -10,5 +10,8 @@ systime_t sysTimeS(void);
 
 
 unsigned long randInt(void);
+void seedRandInt(unsigned long seed);
+
+uint8_t crc8(uint8_t crc, const uint8_t* data, size_t length);
 
 
@@ -0,0 +1,116 @@
+#include "key_events.h"
+#include "common_utils.h"
+
+
+static keyEvent queue[KEY_EVENT_QUEUE_SIZE];
+// free running, only the serial thread moves head and only the render thread tail
+static uint8_t head = 0;
+static uint8_t tail = 0;
+static uint32_t overflows = 0;
+
+static keyMask pressedKeys;
+static uint16_t pressTime[NUM_KEYS];
+
+// the main MCU's clock, as of its last timestamp
+static uint16_t lastTime;
+static systime_t lastTimeReceived;
+
+
+static void syncClock(uint16_t time) {
+    lastTime = time;
+    lastTimeReceived = sysTimeMs();
+}
+
+// The main MCU's current time, extrapolated with the local clock.
+uint16_t key_events_now() {
+    return lastTime + (uint16_t)(sysTimeMs() - lastTimeReceived);
+}
+
+
+static void enqueue(uint8_t col, uint8_t row, uint8_t flags, uint16_t time, uint16_t held) {
+    chSysLock();
+    if ((uint8_t)(head - tail) < KEY_EVENT_QUEUE_SIZE) {
+        queue[head & (KEY_EVENT_QUEUE_SIZE - 1)] = (keyEvent){ col, row, flags, time, held };
+        head++;
+    }
+    else {
+        overflows++;
+    }
+    chSysUnlock();
+}
+
+// Returns how long the key was held when it is released.
+static uint16_t setPressed(uint8_t key, bool pressed, uint16_t time) {
+    uint16_t held = 0;
+
+    chSysLock();
+    if (pressed) {
+        pressedKeys.bits[key >> 5] |= 1u << (key & 31);
+        pressTime[key] = time;
+    }
+    else if (keyMaskTest(&pressedKeys, key)) {
+        pressedKeys.bits[key >> 5] &= ~(1u << (key & 31));
+        held = time - pressTime[key];
+    }
+    chSysUnlock();
+
+    return held;
+}
+
+
+void key_events_push(uint8_t col, uint8_t row, uint8_t flags, uint16_t time) {
+    if (col >= NUM_COLUMN || row >= NUM_ROW)
+        return;
+
+    uint16_t held = 0;
+
+    syncClock(time);
+
+    if (!(flags & KEY_EVENT_TAP))
+        held = setPressed(row * NUM_COLUMN + col, flags & KEY_EVENT_PRESSED, time);
+
+    enqueue(col, row, flags, time, held);
+}
+
+void key_events_setMatrix(const uint8_t* bitmap, uint16_t time) {
+    syncClock(time);
+
+    for (uint8_t key = 0; key < NUM_KEYS; key++) {
+        bool pressed = bitmap[key >> 3] & (1 << (key & 7));
+        if (pressed == keyMaskTest(&pressedKeys, key))
+            continue;
+
+        uint16_t held = setPressed(key, pressed, time);
+        enqueue(key % NUM_COLUMN, key / NUM_COLUMN,
+                KEY_EVENT_SYNC | (pressed ? KEY_EVENT_PRESSED : 0), time, held);
+    }
+}
+
+
+bool key_events_pop(keyEvent* event) {
+    if (tail == head)
+        return false;
+
+    *event = queue[tail & (KEY_EVENT_QUEUE_SIZE - 1)];
+    chSysLock();
+    tail++;
+    chSysUnlock();
+    return true;
+}
+
+bool key_events_isPressed(uint8_t col, uint8_t row) {
+    return keyMaskTest(&pressedKeys, row * NUM_COLUMN + col);
+}
+
+uint16_t key_events_heldMs(uint8_t col, uint8_t row) {
+    uint8_t key = row * NUM_COLUMN + col;
+    if (!keyMaskTest(&pressedKeys, key))
+        return 0;
+
+    return key_events_now() - pressTime[key];
+}
+
+
+uint32_t key_events_getOverflows() {
+    return overflows;
+}
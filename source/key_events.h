@@ -0,0 +1,41 @@
+#pragma once
+
+#include "light_utils.h"
+
+
+/*
+ * Key events from the main MCU. The serial thread queues presses and
+ * releases with the main MCU's millisecond timestamp, the render thread
+ * hands them to the profile. Events that do not fit in the queue are
+ * counted, not silently lost.
+ */
+#define KEY_EVENT_QUEUE_SIZE    32  // power of two
+
+#define KEY_EVENT_PRESSED   0x01    // released when not set
+// from a legacy LED_KEY_PRESSED, no release follows
+#define KEY_EVENT_TAP       0x02
+// from a matrix snapshot that disagreed with the events seen so far
+#define KEY_EVENT_SYNC      0x04
+
+typedef struct {
+    uint8_t col;
+    uint8_t row;
+    uint8_t flags;
+    uint16_t time;  // main MCU ms, wraps every ~65 s
+    uint16_t held;  // releases: ms since the press
+} keyEvent;
+
+// Serial thread side
+void key_events_push(uint8_t col, uint8_t row, uint8_t flags, uint16_t time);
+// bitmap of the pressed keys, key i is bit i & 7 of byte i >> 3
+#define KEY_MATRIX_SIZE ((NUM_KEYS + 7) / 8)
+void key_events_setMatrix(const uint8_t* bitmap, uint16_t time);
+uint16_t key_events_now(void);
+
+// Render thread side
+bool key_events_pop(keyEvent* event);
+bool key_events_isPressed(uint8_t col, uint8_t row);
+// how long the key has been held, 0 if it is not pressed
+uint16_t key_events_heldMs(uint8_t col, uint8_t row);
+
+uint32_t key_events_getOverflows(void);
@@ -0,0 +1,167 @@
+#include "led_compositor.h"
+#include "common_utils.h"
+
+
+static ledLayer* layers[MAX_LAYERS];
+static uint8_t layerCount = 0;
+
+
+void led_compositor_init() {
+    layerCount = 0;
+}
+
+// Layers are stacked in the order they are added.
+bool led_compositor_addLayer(ledLayer* layer) {
+    if (layerCount >= MAX_LAYERS)
+        return false;
+
+    layers[layerCount++] = layer;
+    markAllKeysDirty();
+    return true;
+}
+
+
+//// Sparse Layers ////
+
+void led_layer_clearKeys(ledLayer* layer) {
+    for (uint8_t i = 0; i < layer->sparse.count; i++)
+        markKeyDirty(layer->sparse.entries[i].key);
+
+    layer->sparse.count = 0;
+    for (uint8_t i = 0; i < LEN(layer->sparse.keys.bits); i++)
+        layer->sparse.keys.bits[i] = 0;
+}
+
+// A key that is already set gets its color replaced.
+void led_layer_setKey(ledLayer* layer, uint8_t key, const led_t* color) {
+    sparseLed* entry = layer->sparse.entries;
+    sparseLed* end = entry + layer->sparse.count;
+
+    if (keyMaskTest(&layer->sparse.keys, key)) {
+        while (entry->key != key)
+            entry++;
+    }
+    else if (layer->sparse.count < layer->sparse.size) {
+        entry = end;
+        entry->key = key;
+        layer->sparse.count++;
+        keyMaskSet(&layer->sparse.keys, key);
+    }
+    else {
+        return;
+    }
+
+    entry->color = *color;
+    markKeyDirty(key);
+}
+
+//// ////
+
+
+//// Compose ////
+
+// Returns false if the layer does not cover the key.
+static inline bool layerColor(const ledLayer* layer, uint8_t idx, led_t* color) {
+    switch (layer->type) {
+    case LAYER_DENSE:
+        if (layer->dense.mask && !keyMaskTest(layer->dense.mask, idx))
+            return false;
+
+        *color = layer->dense.colors[idx];
+        break;
+
+    case LAYER_SPARSE: {
+        if (!keyMaskTest(&layer->sparse.keys, idx))
+            return false;
+
+        const sparseLed* entry = layer->sparse.entries;
+        while (entry->key != idx)
+            entry++;
+
+        *color = entry->color;
+        break;
+    }
+
+    case LAYER_SOLID:
+        *color = layer->solid;
+        break;
+
+    default:
+        return false;
+    }
+
+    if (layer->blackIsTransparent && !(color->red || color->green || color->blue))
+        return false;
+
+    return true;
+}
+
+
+static inline void blend(uint8_t* dest, const uint8_t* src, BlendMode mode, uint16_t opacity) {
+    for (uint8_t ch = 0; ch < 3; ch++) {
+        uint16_t value;
+
+        switch (mode) {
+        case BLEND_ADD:
+            value = dest[ch] + src[ch];
+            if (value > 255)
+                value = 255;
+            break;
+
+        case BLEND_MAX:
+            value = dest[ch] > src[ch] ? dest[ch] : src[ch];
+            break;
+
+        case BLEND_MULTIPLY:
+            value = (dest[ch] * (src[ch] + 1)) >> 8;
+            break;
+
+        case BLEND_REPLACE:
+            dest[ch] = src[ch];
+            continue;
+
+        case BLEND_ALPHA:
+        default:
+            value = src[ch];
+            break;
+        }
+
+        if (opacity < LAYER_OPAQUE)
+            value = dest[ch] + (((int32_t)value - dest[ch]) * opacity >> 8);
+
+        dest[ch] = value;
+    }
+}
+
+
+uint16_t led_compositor_compose(led_t* out) {
+    uint16_t dirtyColumns = 0;
+    uint8_t idx = 0;
+
+    for (uint8_t row = 0; row < NUM_ROW; row++) {
+        for (uint8_t col = 0; col < NUM_COLUMN; col++, idx++) {
+            if (!keyIsDirty(idx))
+                continue;
+
+            dirtyColumns |= 1 << col;
+
+            led_t color = { 0, 0, 0 };
+            for (uint8_t l = 0; l < layerCount; l++) {
+                const ledLayer* layer = layers[l];
+                led_t src;
+
+                if (!layer->enabled || !layerColor(layer, idx, &src))
+                    continue;
+
+                blend(&color.red, &src.red, layer->blend, layer->opacity);
+            }
+
+            out[idx] = color;
+        }
+    }
+
+    clearDirtyKeys();
+    return dirtyColumns;
+}
+
+//// ////
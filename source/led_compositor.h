@@ -0,0 +1,65 @@
+#pragma once
+
+#include "light_utils.h"
+
+
+/*
+ * Layers are composed bottom to top, one key at a time, and only for the
+ * keys marked dirty. Layers never copy colors:
+ *  - LAYER_DENSE:  points at an existing led_t buffer, optionally masked.
+ *  - LAYER_SPARSE: a short list of key/color entries, e.g. status indicators.
+ *  - LAYER_SOLID:  one color for every key, e.g. a brightness multiplier.
+ */
+#define MAX_LAYERS 8
+
+// Full opacity, scales are 0-256 like everywhere else
+#define LAYER_OPAQUE 256
+
+typedef enum { LAYER_DENSE = 0, LAYER_SPARSE, LAYER_SOLID } LayerType;
+
+typedef enum {
+    BLEND_REPLACE = 0,  // always opaque
+    BLEND_ADD,
+    BLEND_MAX,
+    BLEND_ALPHA,        // replace, faded by the opacity
+    BLEND_MULTIPLY      // 255 keeps the color below
+} BlendMode;
+
+typedef struct {
+    uint8_t key;
+    led_t color;
+} sparseLed;
+
+typedef struct {
+    LayerType type;
+    BlendMode blend;
+    uint16_t opacity;
+    bool enabled;
+    // black keys let the layers below through
+    bool blackIsTransparent;
+
+    union {
+        struct {
+            const led_t* colors;
+            const keyMask* mask; // NULL covers every key
+        } dense;
+
+        struct {
+            sparseLed* entries;
+            uint8_t size;
+            uint8_t count;
+            keyMask keys;
+        } sparse;
+
+        led_t solid;
+    };
+} ledLayer;
+
+
+void led_compositor_init(void);
+bool led_compositor_addLayer(ledLayer* layer);
+// Composes the dirty keys into out and clears them, returns the changed columns.
+uint16_t led_compositor_compose(led_t* out);
+
+void led_layer_clearKeys(ledLayer* layer);
+void led_layer_setKey(ledLayer* layer, uint8_t key, const led_t* color);
@@ -0,0 +1,87 @@
+/*
+ * Generated by host/gen_gamma.c, do not edit.
+ * level = ((1 << GAMMA_TABLE_BITS) - 1) * gain * (value / 255) ^ gamma
+ *   red    gamma 2.20  gain 1.00
+ *   green  gamma 2.20  gain 0.80
+ *   blue   gamma 2.20  gain 0.90
+ * light = (1 << GAMMA_TABLE_BITS) * (scale / 256) ^ 2.20
+ */
+#include "led_gamma.h"
+
+
+const uint16_t gammaTable[3][256] = {
+    { // red
+           0,    0,    0,    0,    0,    1,    1,    2,    2,    3,    3,    4,    5,    6,    7,    8,
+           9,   11,   12,   14,   15,   17,   19,   21,   23,   25,   27,   29,   32,   34,   37,   40,
+          43,   46,   49,   52,   55,   59,   62,   66,   70,   73,   77,   82,   86,   90,   95,   99,
+         104,  109,  114,  119,  124,  129,  135,  140,  146,  152,  158,  164,  170,  176,  182,  189,
+         196,  202,  209,  216,  224,  231,  238,  246,  254,  261,  269,  277,  286,  294,  302,  311,
+         320,  328,  337,  347,  356,  365,  375,  384,  394,  404,  414,  424,  435,  445,  456,  467,
+         477,  488,  500,  511,  522,  534,  545,  557,  569,  581,  594,  606,  619,  631,  644,  657,
+         670,  683,  697,  710,  724,  738,  752,  766,  780,  794,  809,  823,  838,  853,  868,  884,
+         899,  914,  930,  946,  962,  978,  994, 1011, 1027, 1044, 1061, 1078, 1095, 1112, 1130, 1147,
+        1165, 1183, 1201, 1219, 1237, 1256, 1274, 1293, 1312, 1331, 1350, 1370, 1389, 1409, 1429, 1449,
+        1469, 1489, 1509, 1530, 1551, 1572, 1593, 1614, 1635, 1657, 1678, 1700, 1722, 1744, 1766, 1789,
+        1811, 1834, 1857, 1880, 1903, 1926, 1950, 1974, 1997, 2021, 2045, 2070, 2094, 2119, 2143, 2168,
+        2193, 2219, 2244, 2270, 2295, 2321, 2347, 2373, 2400, 2426, 2453, 2479, 2506, 2534, 2561, 2588,
+        2616, 2644, 2671, 2700, 2728, 2756, 2785, 2813, 2842, 2871, 2900, 2930, 2959, 2989, 3019, 3049,
+        3079, 3109, 3140, 3170, 3201, 3232, 3263, 3295, 3326, 3358, 3390, 3421, 3454, 3486, 3518, 3551,
+        3584, 3617, 3650, 3683, 3716, 3750, 3784, 3818, 3852, 3886, 3920, 3955, 3990, 4025, 4060, 4095,
+    },
+    { // green
+           0,    0,    0,    0,    0,    1,    1,    1,    2,    2,    3,    3,    4,    5,    6,    6,
+           7,    8,   10,   11,   12,   13,   15,   16,   18,   20,   22,   23,   25,   27,   30,   32,
+          34,   36,   39,   41,   44,   47,   50,   53,   56,   59,   62,   65,   69,   72,   76,   79,
+          83,   87,   91,   95,   99,  103,  108,  112,  117,  121,  126,  131,  136,  141,  146,  151,
+         157,  162,  167,  173,  179,  185,  191,  197,  203,  209,  215,  222,  228,  235,  242,  249,
+         256,  263,  270,  277,  285,  292,  300,  308,  315,  323,  331,  340,  348,  356,  365,  373,
+         382,  391,  400,  409,  418,  427,  436,  446,  455,  465,  475,  485,  495,  505,  515,  526,
+         536,  547,  557,  568,  579,  590,  601,  613,  624,  635,  647,  659,  671,  683,  695,  707,
+         719,  732,  744,  757,  770,  782,  795,  809,  822,  835,  849,  862,  876,  890,  904,  918,
+         932,  946,  961,  975,  990, 1005, 1019, 1034, 1050, 1065, 1080, 1096, 1111, 1127, 1143, 1159,
+        1175, 1191, 1208, 1224, 1241, 1257, 1274, 1291, 1308, 1325, 1343, 1360, 1378, 1395, 1413, 1431,
+        1449, 1467, 1486, 1504, 1522, 1541, 1560, 1579, 1598, 1617, 1636, 1656, 1675, 1695, 1715, 1735,
+        1755, 1775, 1795, 1816, 1836, 1857, 1878, 1899, 1920, 1941, 1962, 1984, 2005, 2027, 2049, 2071,
+        2093, 2115, 2137, 2160, 2182, 2205, 2228, 2251, 2274, 2297, 2320, 2344, 2367, 2391, 2415, 2439,
+        2463, 2487, 2512, 2536, 2561, 2586, 2611, 2636, 2661, 2686, 2712, 2737, 2763, 2789, 2815, 2841,
+        2867, 2893, 2920, 2946, 2973, 3000, 3027, 3054, 3081, 3109, 3136, 3164, 3192, 3220, 3248, 3276,
+    },
+    { // blue
+           0,    0,    0,    0,    0,    1,    1,    1,    2,    2,    3,    4,    4,    5,    6,    7,
+           8,   10,   11,   12,   14,   15,   17,   19,   20,   22,   24,   26,   29,   31,   33,   36,
+          38,   41,   44,   47,   50,   53,   56,   59,   63,   66,   70,   73,   77,   81,   85,   89,
+          94,   98,  102,  107,  112,  116,  121,  126,  131,  136,  142,  147,  153,  158,  164,  170,
+         176,  182,  188,  195,  201,  208,  214,  221,  228,  235,  242,  250,  257,  264,  272,  280,
+         288,  296,  304,  312,  320,  329,  337,  346,  355,  364,  373,  382,  391,  401,  410,  420,
+         430,  440,  450,  460,  470,  480,  491,  502,  512,  523,  534,  545,  557,  568,  580,  591,
+         603,  615,  627,  639,  652,  664,  676,  689,  702,  715,  728,  741,  754,  768,  781,  795,
+         809,  823,  837,  851,  866,  880,  895,  910,  924,  939,  955,  970,  985, 1001, 1017, 1032,
+        1048, 1064, 1081, 1097, 1113, 1130, 1147, 1164, 1181, 1198, 1215, 1233, 1250, 1268, 1286, 1304,
+        1322, 1340, 1358, 1377, 1396, 1414, 1433, 1452, 1472, 1491, 1510, 1530, 1550, 1570, 1590, 1610,
+        1630, 1651, 1671, 1692, 1713, 1734, 1755, 1776, 1798, 1819, 1841, 1863, 1885, 1907, 1929, 1952,
+        1974, 1997, 2020, 2043, 2066, 2089, 2112, 2136, 2160, 2183, 2207, 2232, 2256, 2280, 2305, 2329,
+        2354, 2379, 2404, 2430, 2455, 2481, 2506, 2532, 2558, 2584, 2610, 2637, 2663, 2690, 2717, 2744,
+        2771, 2798, 2826, 2853, 2881, 2909, 2937, 2965, 2994, 3022, 3051, 3079, 3108, 3137, 3166, 3196,
+        3225, 3255, 3285, 3315, 3345, 3375, 3405, 3436, 3467, 3497, 3528, 3560, 3591, 3622, 3654, 3686,
+    },
+};
+
+const uint16_t brightnessCurve[257] = {
+       0,    0,    0,    0,    0,    1,    1,    1,    2,    3,    3,    4,    5,    6,    7,    8,
+       9,   11,   12,   13,   15,   17,   19,   20,   22,   25,   27,   29,   31,   34,   37,   39,
+      42,   45,   48,   51,   55,   58,   62,   65,   69,   73,   77,   81,   85,   89,   94,   98,
+     103,  108,  113,  118,  123,  128,  134,  139,  145,  150,  156,  162,  168,  175,  181,  187,
+     194,  201,  208,  215,  222,  229,  236,  244,  251,  259,  267,  275,  283,  291,  300,  308,
+     317,  326,  335,  344,  353,  362,  372,  381,  391,  401,  411,  421,  431,  441,  452,  463,
+     473,  484,  495,  507,  518,  529,  541,  553,  565,  577,  589,  601,  613,  626,  639,  652,
+     665,  678,  691,  704,  718,  732,  745,  759,  773,  788,  802,  817,  831,  846,  861,  876,
+     891,  907,  922,  938,  954,  970,  986, 1002, 1019, 1035, 1052, 1069, 1086, 1103, 1120, 1138,
+    1155, 1173, 1191, 1209, 1227, 1245, 1264, 1282, 1301, 1320, 1339, 1358, 1378, 1397, 1417, 1437,
+    1456, 1477, 1497, 1517, 1538, 1558, 1579, 1600, 1621, 1643, 1664, 1686, 1708, 1730, 1752, 1774,
+    1796, 1819, 1841, 1864, 1887, 1910, 1934, 1957, 1981, 2005, 2028, 2053, 2077, 2101, 2126, 2150,
+    2175, 2200, 2225, 2251, 2276, 2302, 2328, 2353, 2380, 2406, 2432, 2459, 2486, 2512, 2539, 2567,
+    2594, 2622, 2649, 2677, 2705, 2733, 2761, 2790, 2819, 2847, 2876, 2905, 2935, 2964, 2994, 3023,
+    3053, 3083, 3114, 3144, 3175, 3205, 3236, 3267, 3298, 3330, 3361, 3393, 3425, 3457, 3489, 3521,
+    3554, 3586, 3619, 3652, 3685, 3719, 3752, 3786, 3820, 3854, 3888, 3922, 3957, 3991, 4026, 4061,
+    4096,
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+
+/*
+ * Output level of every channel value, per color (red, green, blue),
+ * gamma corrected and white balanced, with GAMMA_TABLE_BITS of precision.
+ * The frame compile scales it down to the bit depth of the scan mode.
+ * Generated by host/gen_gamma.c.
+ */
+#define GAMMA_TABLE_BITS 12
+
+extern const uint16_t gammaTable[3][256];
+
+/*
+ * Light of a brightness scale (0-256) as a factor on gammaTable levels,
+ * 1 << GAMMA_TABLE_BITS is full brightness.
+ */
+extern const uint16_t brightnessCurve[257];
@@ -4,6 +4,8 @@
 #include "ch.h"
 #include "light_utils.h"
 #include "led_state.h"
+#include "perf_stats.h"
+#include "led_gamma.h"
 
 
 ioline_t ledColumns[NUM_COLUMN] = {
@@ -48,51 +50,450 @@ ioline_t ledRows[NUM_ROW * 4] = {
 
 
 /*
-#define REFRESH_FREQUENCY 180
+ * Refresh rate is the number of full column sweeps per second.
+ * The scan is driven by BFTM0, so the CPU is free between two steps.
+ *
+ * SCAN_SPWM: one column step per interrupt, each lit column visit is one
+ *            slot of a free running 8-bit PWM counter.
+ * SCAN_BCM:  binary code modulation, every column is shown for BCM_BITS
+ *            bit-planes with hold times of ... 4, 2, 1 units, MSB first,
+ *            one interrupt per bit-plane.
+ *
+ * LED_BCM_BITS above 7 keeps more of the gamma table's precision in the
+ * dim range, but the shortest bit-plane must still outlast the scan
+ * interrupt, which only works at a lower LED_BCM_REFRESH_FREQUENCY.
+ * LED_DITHERING adds a half unit of BCM precision, see the dither plane.
+ */
+#ifndef LED_SCAN_MODE
+#define LED_SCAN_MODE SCAN_SPWM
+#endif
 
-static const GPTConfig bftm0Config = {	
-    .frequency = NUM_COLUMN * REFRESH_FREQUENCY * 2 * 16,	
-    .callback = columnCallback	
+#ifndef LED_REFRESH_FREQUENCY
+#define LED_REFRESH_FREQUENCY 5760
+#endif
+
+#ifndef LED_BCM_REFRESH_FREQUENCY
+#define LED_BCM_REFRESH_FREQUENCY 120
+#endif
+
+#ifndef LED_BCM_BITS
+#define LED_BCM_BITS 7
+#endif
+
+#ifndef LED_GAMMA_CORRECTION
+#define LED_GAMMA_CORRECTION 1
+#endif
+
+#ifndef LED_DITHERING
+#define LED_DITHERING 1
+#endif
+
+#ifndef LED_ADAPTIVE_SCAN
+#define LED_ADAPTIVE_SCAN 1
+#endif
+
+#define BCM_BITS LED_BCM_BITS
+#define SPWM_BITS 8
+
+#if LED_DITHERING
+#define BCM_DITHER_BITS 1
+#else
+#define BCM_DITHER_BITS 0
+#endif
+#define BCM_PLANES (BCM_BITS + BCM_DITHER_BITS)
+
+#define LED_SCAN_TIMER_FREQUENCY 8000000
+#define LED_SCAN_CPU_FREQUENCY 48000000
+#define LED_SCAN_STEP_INTERVAL (LED_SCAN_TIMER_FREQUENCY / (NUM_COLUMN * LED_REFRESH_FREQUENCY))
+// the dither plane adds one unit to every column
+#define BCM_COLUMN_UNITS ((1 << BCM_BITS) - 1 + BCM_DITHER_BITS)
+#define LED_BCM_UNIT_INTERVAL (LED_SCAN_TIMER_FREQUENCY / (NUM_COLUMN * LED_BCM_REFRESH_FREQUENCY * BCM_COLUMN_UNITS))
+#define LED_BCM_COLUMN_INTERVAL (LED_BCM_UNIT_INTERVAL * BCM_COLUMN_UNITS)
+
+/*
+ * CPU cycles of a bit-plane interrupt that does not switch the column:
+ * about 35 for exception entry and exit, 45 for the OS and GPT driver
+ * around the callback, 90 for bcmStep and 30 for the interval change.
+ * The column switch runs in the longest plane, so only this has to fit
+ * into one unit. Check it against LED_RUN_BENCHMARK's scan sweep and the
+ * scan overrun count before shortening the unit.
+ */
+#ifndef LED_BCM_ISR_CYCLES
+#define LED_BCM_ISR_CYCLES 200
+#endif
+
+#if LED_BCM_UNIT_INTERVAL * (LED_SCAN_CPU_FREQUENCY / LED_SCAN_TIMER_FREQUENCY) < LED_BCM_ISR_CYCLES
+#error "BCM bit-planes shorter than the scan interrupt, lower LED_BCM_BITS or LED_BCM_REFRESH_FREQUENCY"
+#endif
+
+static void columnCallback(GPTDriver* driver);
+static void initChannelPins(void);
+static void startScan(void);
+static void switchScanMode(ScanMode mode, const led_t* leds);
+static void compileFrame(const led_t* leds, uint8_t frameIdx, uint16_t columns);
+
+static const GPTConfig bftm0Config = {
+    .frequency = LED_SCAN_TIMER_FREQUENCY,
+    .callback = columnCallback
 };
-*/
 
-static void columnCallback(void);
+static ScanMode scanMode = LED_SCAN_MODE;
+
+static uint8_t currentColumn = 0;
+static bool colHasBeenSet = true;
+// bit-plane slot of the current column, 0 shows the MSB
+static uint8_t bcmSlot = 0;
+static uint32_t scanInterval;
+// false while sweeps are run directly, see led_multiplexing_runSweep
+static bool scanRunning = false;
+
+
+void led_multiplexing_init() {
+    initChannelPins();
+
+    // Setup Column Multiplex Timer
+    gptStart(&GPTD_BFTM0, &bftm0Config);
+    startScan();
+}
+
+//// Frame Compile ////
+/*
+ * The scan ISR never touches led_t values. Once per rendered frame each
+ * column is compiled into whole-port row masks:
+ *  - sPWM: the channels that are lit at all, plus their PWM thresholds in
+ *    ascending order. For a given PWM counter the ISR only drops the channels
+ *    whose threshold has been reached.
+ *  - BCM: one set of row port masks per bit-plane.
+ * Either way the ISR writes one set and one clear word per row port.
+ */
+
+#define NUM_CHANNEL (NUM_ROW * 3)
+#define LED_ROW_PORT_COUNT 3
 
+static const ioportid_t ledRowPorts[LED_ROW_PORT_COUNT] = { IOPORTA, IOPORTB, IOPORTC };
 
-THD_WORKING_AREA(waThread1, 128);
-    __attribute__((noreturn)) THD_FUNCTION(Thread1, arg) {
-    (void)arg;
+typedef struct {
+    uint8_t port;
+    uint16_t mask;
+} channelPin;
 
-    while(true) {
-        columnCallback();
+static channelPin channelPins[NUM_CHANNEL];
+static uint16_t rowPortMasks[LED_ROW_PORT_COUNT];
+
+typedef struct {
+    uint16_t onMask[LED_ROW_PORT_COUNT];
+    uint8_t thresholdCount;
+    uint8_t threshold[NUM_CHANNEL];
+    uint8_t channel[NUM_CHANNEL];
+} compiledColumn;
+
+// planeMask[BCM_BITS] is the dither plane
+typedef struct {
+    uint16_t planeMask[BCM_PLANES][LED_ROW_PORT_COUNT];
+} compiledColumnBcm;
+
+// Only the active scan mode needs its compiled form.
+typedef struct {
+    // columns with at least one channel on, the scan skips the others
+    uint16_t litColumns;
+    union {
+        compiledColumn spwm[NUM_COLUMN];
+        compiledColumnBcm bcm[NUM_COLUMN];
+    };
+} compiledFrame;
+
+/*
+ * Double buffered handoff between renderer and scan ISR.
+ * The renderer compiles into the back frame and publishes it by setting
+ * backFrameReady. The scan ISR flips the pointers at the start of a sweep
+ * (column 0), so a sweep never mixes two frames. Before writing, the
+ * renderer revokes a pending publish; if the flip already happened the
+ * back pointer then refers to the frame the ISR has just released.
+ * The frames themselves are not volatile, so compiler barriers keep their
+ * stores from moving across the revoke and the publish (LTO inlines the
+ * whole compile into the render thread). A single core needs no more.
+ */
+#define frameBarrier() __asm volatile("" ::: "memory")
+
+static compiledFrame compiledFrames[2];
+static compiledFrame* volatile frontFrame = &compiledFrames[0];
+static compiledFrame* volatile backFrame = &compiledFrames[1];
+static volatile bool backFrameReady = false;
+
+// the back frame shows a key event, see perf_takeKeyEvent
+static volatile bool backFrameKeyTagged = false;
+static uint32_t backFrameKeyCycles;
+
+/*
+ * Only changed columns are recompiled. A buffer that was not compiled into
+ * for a frame misses that frame's changes, so they are remembered per
+ * buffer and caught up the next time it becomes the back frame.
+ */
+static uint16_t staleColumns[2] = { 0, ALL_COLUMNS };
+
+static volatile ScanMode requestedScanMode = LED_SCAN_MODE;
+
+
+/*
+ * Temporal dithering (BCM only): the gamma table is more precise than the
+ * scan. The dither plane holds the half unit a channel was rounded down
+ * by and lights it for one unit on every other sweep, so the pattern runs
+ * at half the refresh rate and never waits for the next frame.
+ * An sPWM column only sees all of its PWM counter values over 256 sweeps,
+ * there is no faster pattern to dither with.
+ */
+static bool dithering = LED_DITHERING;
+static volatile bool requestedDithering = LED_DITHERING;
+#if BCM_DITHER_BITS
+static bool ditherPhase = false;
+static const uint16_t darkRows[LED_ROW_PORT_COUNT] = { 0 };
+#endif
+
+
+/*
+ * Brightness is applied here rather than to the 8-bit composed colors, so
+ * a dimmed key keeps the gamma table's precision. undimmedKeys (the
+ * indicators) stay at full brightness.
+ */
+#define FULL_LIGHT (1 << GAMMA_TABLE_BITS)
+
+static uint16_t brightnessLight = FULL_LIGHT;
+static const keyMask* undimmedKeys = NULL;
+
+
+/*
+ * Output stage, fused into the compile: channel values are gamma corrected
+ * and white balanced through gammaTable, dimmed by light (FULL_LIGHT is
+ * full brightness) and scaled to the bit depth of the scan mode, the
+ * dither bit included. A lit channel never rounds down to off.
+ */
+static inline uint16_t outputLevel(uint8_t color, uint8_t value, uint16_t light, uint8_t bits) {
+#if LED_GAMMA_CORRECTION
+    uint32_t level = gammaTable[color][value];
+#else
+    (void)color;
+    uint32_t level = (value << (GAMMA_TABLE_BITS - 8)) | (value >> (16 - GAMMA_TABLE_BITS));
+#endif
+
+    level = (level * light) >> (2 * GAMMA_TABLE_BITS - bits);
+    return (value && !level) ? 1 : level;
+}
+
+static inline uint16_t keyLight(uint8_t idx) {
+    return undimmedKeys && keyMaskTest(undimmedKeys, idx) ? FULL_LIGHT : brightnessLight;
+}
+
+
+static void initChannelPins(void) {
+    for (uint8_t ch = 0; ch < NUM_CHANNEL; ch++) {
+        ioline_t line = ledRows[((ch / 3) << 2) | (ch % 3)];
+
+        for (uint8_t port = 0; port < LED_ROW_PORT_COUNT; port++) {
+            if (PAL_PORT(line) == ledRowPorts[port]) {
+                channelPins[ch].port = port;
+                channelPins[ch].mask = 1 << PAL_PAD(line);
+                rowPortMasks[port] |= channelPins[ch].mask;
+            }
+        }
     }
 }
 
 
-void led_multiplexing_init() {
-    // Setup Column Multiplex Timer	
-    // gptStart(&GPTD_BFTM0, &bftm0Config);	
-    // gptStartContinuous(&GPTD_BFTM0, 1);
+static void compileColumn(const led_t* leds, uint8_t column, compiledColumn* compiled) {
+    uint8_t count = 0;
+
+    for (uint8_t port = 0; port < LED_ROW_PORT_COUNT; port++)
+        compiled->onMask[port] = 0;
+
+    for (uint8_t row = 0; row < NUM_ROW; row++) {
+        const uint8_t idx = row * NUM_COLUMN + column;
+        const uint8_t* values = &leds[idx].red;
+        const uint16_t light = keyLight(idx);
+
+        for (uint8_t color = 0; color < 3; color++) {
+            uint8_t value = outputLevel(color, values[color], light, SPWM_BITS);
+            if (value == 0)
+                continue;
+
+            uint8_t ch = row * 3 + color;
+            compiled->onMask[channelPins[ch].port] |= channelPins[ch].mask;
 
-    chThdCreateStatic(waThread1, sizeof(waThread1), NORMALPRIO, Thread1, NULL);
+            // insertion sort, thresholds ascending
+            uint8_t i = count++;
+            while (i > 0 && compiled->threshold[i - 1] > value) {
+                compiled->threshold[i] = compiled->threshold[i - 1];
+                compiled->channel[i] = compiled->channel[i - 1];
+                i--;
+            }
+            compiled->threshold[i] = value;
+            compiled->channel[i] = ch;
+        }
+    }
+
+    compiled->thresholdCount = count;
 }
 
-inline bool sPWM(uint8_t value, uint8_t pwmCounter, uint8_t column, bool cycleState, ioline_t port) {
-    if (pwmCounter < value && (column + cycleState) % 2) {
-        palSetLine(port);
-        return true;
+
+static void compileColumnBcm(const led_t* leds, uint8_t column, compiledColumnBcm* compiled) {
+    const uint8_t ditherBits = dithering ? BCM_DITHER_BITS : 0;
+
+    for (uint8_t bit = 0; bit < BCM_PLANES; bit++)
+        for (uint8_t port = 0; port < LED_ROW_PORT_COUNT; port++)
+            compiled->planeMask[bit][port] = 0;
+
+    for (uint8_t row = 0; row < NUM_ROW; row++) {
+        const uint8_t idx = row * NUM_COLUMN + column;
+        const uint8_t* values = &leds[idx].red;
+        const uint16_t light = keyLight(idx);
+
+        for (uint8_t color = 0; color < 3; color++) {
+            const channelPin* pin = &channelPins[row * 3 + color];
+            uint16_t level = outputLevel(color, values[color], light, BCM_BITS + ditherBits);
+
+#if BCM_DITHER_BITS
+            if (ditherBits) {
+                if (level & 1)
+                    compiled->planeMask[BCM_BITS][pin->port] |= pin->mask;
+                level >>= 1;
+            }
+#endif
+
+            for (uint8_t bit = 0; level; level >>= 1, bit++) {
+                if (level & 1)
+                    compiled->planeMask[bit][pin->port] |= pin->mask;
+            }
+        }
     }
-    else {
-        palClearLine(port);
-        return false;
+}
+
+
+static void compileFrame(const led_t* leds, uint8_t frameIdx, uint16_t columns) {
+    compiledFrame* frame = &compiledFrames[frameIdx];
+
+    staleColumns[frameIdx] &= ~columns;
+    staleColumns[frameIdx ^ 1] |= columns;
+
+    for (uint8_t column = 0; column < NUM_COLUMN; column++) {
+        if (!(columns & (1 << column)))
+            continue;
+
+        bool lit = false;
+        if (scanMode == SCAN_BCM) {
+            compileColumnBcm(leds, column, &frame->bcm[column]);
+
+            // the lowest bit-plane may be empty, the column is lit if any one is set
+            for (uint8_t bit = 0; bit < BCM_PLANES; bit++)
+                for (uint8_t port = 0; port < LED_ROW_PORT_COUNT; port++)
+                    lit |= frame->bcm[column].planeMask[bit][port] != 0;
+        }
+        else {
+            compileColumn(leds, column, &frame->spwm[column]);
+            lit = frame->spwm[column].thresholdCount != 0;
+        }
+
+        if (lit)
+            frame->litColumns |= 1 << column;
+        else
+            frame->litColumns &= ~(1 << column);
     }
 }
 
 
-static void columnCallback() {
+static void switchScanMode(ScanMode mode, const led_t* leds) {
+    gptStopTimer(&GPTD_BFTM0);
+    palClearLine(ledColumns[currentColumn]);
+
+    // The scan is stopped, so the front frame can be recompiled in place.
+    scanMode = mode;
+    backFrameReady = false;
+    compileFrame(leds, frontFrame - compiledFrames, ALL_COLUMNS);
+
+    startScan();
+}
+
+
+void led_multiplexing_compileFrame(const led_t* leds, uint16_t changedColumns) {
+    // Mode switches are applied here so they never race with a compile,
+    // and wait while the scan is stopped, as it would restart it.
+    if (requestedScanMode != scanMode && scanRunning)
+        switchScanMode(requestedScanMode, leds);
+
+    if (requestedDithering != dithering) {
+        dithering = requestedDithering;
+        changedColumns = ALL_COLUMNS;
+    }
+
+    // A frame that changes nothing leaves the key event to the one that does.
+    uint32_t keyCycles;
+    bool keyEvent = changedColumns && scanRunning && perf_takeKeyEvent(&keyCycles);
+
+    // Nothing changed, the frame on display (or the one pending) is current.
+    if (!changedColumns)
+        return;
+
+    backFrameReady = false;
+    frameBarrier();
+
+    // a revoked frame keeps its tag, the key is still waiting for it
+    if (keyEvent && !backFrameKeyTagged) {
+        backFrameKeyCycles = keyCycles;
+        backFrameKeyTagged = true;
+    }
+
+    uint8_t backIdx = backFrame - compiledFrames;
+    compileFrame(leds, backIdx, changedColumns | staleColumns[backIdx]);
+    frameBarrier();
+    backFrameReady = true;
+}
+
+
+static inline void flipFrames(void) {
+    if (backFrameReady) {
+        compiledFrame* frame = frontFrame;
+        frontFrame = backFrame;
+        backFrame = frame;
+        backFrameReady = false;
+
+        if (backFrameKeyTagged) {
+            perf_recordKeyLatency(perf_cycleCount() - backFrameKeyCycles);
+            backFrameKeyTagged = false;
+        }
+    }
+}
+
+// A directly run sweep keeps showing the front frame and counts nothing.
+static inline void startSweep(void) {
+    if (!scanRunning)
+        return;
+
+    flipFrames();
+    perf_countScanRefresh();
+}
+
+//// ////
+
+
+//// Scan ////
+
+static void writeRows(const uint16_t* rowMasks) {
+    colHasBeenSet = false;
+    for (uint8_t port = 0; port < LED_ROW_PORT_COUNT; port++) {
+        palSetPort(ledRowPorts[port], rowMasks[port]);
+        palClearPort(ledRowPorts[port], rowPortMasks[port] & ~rowMasks[port]);
+        colHasBeenSet |= rowMasks[port] != 0;
+    }
+}
+
+
+/*
+ * Adaptive scan: a step that lights nothing also waits out the dark slots
+ * after it, so dark columns cost no interrupt. The slots keep their
+ * length and the next sweep always starts on time, so the brightness and
+ * the refresh rate do not depend on how many columns are lit.
+ * Both steps return the time until the next one in scan timer ticks.
+ */
+static uint32_t spwmStep(void) {
     static uint8_t pwmCounter = 0;
-    static uint8_t currentColumn = 0;
-    static bool colHasBeenSet = true;
 
     /* 
      * @var cycleState Keeps track of which columns are updated in the current cycle (odd or even).
@@ -106,24 +507,207 @@ static void columnCallback() {
         palClearLine(ledColumns[currentColumn]);
 
 
-    currentColumn = (currentColumn + 1) % NUM_COLUMN;
-    if (currentColumn == 0) {
+    if (++currentColumn == NUM_COLUMN) {
+        currentColumn = 0;
         cycleState = !cycleState;
+        startSweep();
     }
 
-    colHasBeenSet = false;
-    
-    for (uint8_t row = 0; row < NUM_ROW; row++) {
-        const led_t keyLED = getLedsToDisplay()[currentColumn + NUM_COLUMN * row];
+    uint16_t rowMasks[LED_ROW_PORT_COUNT] = { 0 };
+    bool columnActive = (currentColumn + cycleState) & 1;
 
-        colHasBeenSet += sPWM(keyLED.red, pwmCounter, currentColumn, cycleState, ledRows[row << 2]);
-        colHasBeenSet += sPWM(keyLED.green, pwmCounter, currentColumn, cycleState, ledRows[(row << 2) | 1]);
-        colHasBeenSet += sPWM(keyLED.blue, pwmCounter, currentColumn, cycleState, ledRows[(row << 2) | 2]);
-    }
+    if (columnActive) {
+        const compiledColumn* compiled = &frontFrame->spwm[currentColumn];
+
+        for (uint8_t port = 0; port < LED_ROW_PORT_COUNT; port++)
+            rowMasks[port] = compiled->onMask[port];
+
+        // a channel is lit while pwmCounter < value
+        for (uint8_t i = 0; i < compiled->thresholdCount && compiled->threshold[i] <= pwmCounter; i++) {
+            const channelPin* pin = &channelPins[compiled->channel[i]];
+            rowMasks[pin->port] &= ~pin->mask;
+        }
 
-    if ((currentColumn + cycleState) % 2) 
         pwmCounter++;
+    }
+
+    writeRows(rowMasks);
+
+    if (colHasBeenSet) {
+        palSetLine(ledColumns[currentColumn]);
+        return LED_SCAN_STEP_INTERVAL;
+    }
+
+    uint8_t slots = 1;
+#if LED_ADAPTIVE_SCAN
+    // the PWM counter still advances on skipped active slots, or the
+    // columns would no longer see every counter value in turn
+    while (currentColumn + 1 < NUM_COLUMN) {
+        uint8_t next = currentColumn + 1;
+        bool nextActive = (next + cycleState) & 1;
+
+        if (nextActive && (frontFrame->litColumns & (1 << next)))
+            break;
+
+        currentColumn = next;
+        slots++;
+        if (nextActive)
+            pwmCounter++;
+    }
+#endif
+
+    return slots * LED_SCAN_STEP_INTERVAL;
+}
+
+
+static uint32_t bcmStep(void) {
+    if (bcmSlot == 0) {
+        palClearLine(ledColumns[currentColumn]);
+
+        if (++currentColumn == NUM_COLUMN) {
+            currentColumn = 0;
+#if BCM_DITHER_BITS
+            ditherPhase = !ditherPhase;
+#endif
+            startSweep();
+        }
+
+#if LED_ADAPTIVE_SCAN
+        // a dark column is skipped whole, along with the dark ones after it
+        if (!(frontFrame->litColumns & (1 << currentColumn))) {
+            uint8_t columns = 1;
+            while (currentColumn + 1 < NUM_COLUMN && !(frontFrame->litColumns & (1 << (currentColumn + 1)))) {
+                currentColumn++;
+                columns++;
+            }
+
+            writeRows(frontFrame->bcm[currentColumn].planeMask[0]);
+            return columns * LED_BCM_COLUMN_INTERVAL;
+        }
+#endif
+    }
+
+    // MSB first, so the column switch above takes its time from the
+    // longest plane; the dither plane comes last
+    uint8_t plane = bcmSlot < BCM_BITS ? BCM_BITS - 1 - bcmSlot : bcmSlot;
+    const uint16_t* rowMasks = frontFrame->bcm[currentColumn].planeMask[plane];
+    uint32_t interval = LED_BCM_UNIT_INTERVAL << plane;
+
+#if BCM_DITHER_BITS
+    // the dither plane is one unit long and dark on every other sweep
+    if (plane == BCM_BITS) {
+        interval = LED_BCM_UNIT_INTERVAL;
+        if (!ditherPhase)
+            rowMasks = darkRows;
+    }
+#endif
+
+    writeRows(rowMasks);
 
-    if (colHasBeenSet && (currentColumn + cycleState) % 2)
+    // The column line stays on across bit-planes, only the rows change,
+    // so it follows the whole column rather than the first plane's rows.
+    if (bcmSlot == 0 && (frontFrame->litColumns & (1 << currentColumn)))
         palSetLine(ledColumns[currentColumn]);
-}
\ No newline at end of file
+
+    if (++bcmSlot == BCM_PLANES)
+        bcmSlot = 0;
+    return interval;
+}
+
+
+static void columnCallback(GPTDriver* driver) {
+    (void)driver;
+
+    uint32_t interval = scanMode == SCAN_BCM ? bcmStep() : spwmStep();
+
+    if (interval != scanInterval) {
+        scanInterval = interval;
+
+        chSysLockFromISR();
+        gptChangeIntervalI(&GPTD_BFTM0, interval);
+        chSysUnlockFromISR();
+    }
+}
+
+
+static void startScan(void) {
+    bcmSlot = 0;
+
+    if (scanMode == SCAN_BCM) {
+        perf_setScanSweepTime(1000000 / LED_BCM_REFRESH_FREQUENCY);
+        scanInterval = LED_BCM_UNIT_INTERVAL;
+    }
+    else {
+        perf_setScanSweepTime(1000000 / LED_REFRESH_FREQUENCY);
+        scanInterval = LED_SCAN_STEP_INTERVAL;
+    }
+
+    scanRunning = true;
+    gptStartContinuous(&GPTD_BFTM0, scanInterval);
+}
+
+
+/*
+ * LED_RUN_BENCHMARK times the scan steps back to back in thread context.
+ * The scan timer is stopped meanwhile, so its interrupt neither competes
+ * with the measurement nor runs a step at the same time.
+ * The low-power idle stops the scan the same way.
+ */
+void led_multiplexing_stopScan() {
+    gptStopTimer(&GPTD_BFTM0);
+    scanRunning = false;
+    palClearLine(ledColumns[currentColumn]);
+}
+
+// as many steps as fit into the time of one sweep
+void led_multiplexing_runSweep() {
+    uint32_t sweep = scanMode == SCAN_BCM ?
+        NUM_COLUMN * LED_BCM_COLUMN_INTERVAL : NUM_COLUMN * LED_SCAN_STEP_INTERVAL;
+
+    for (uint32_t elapsed = 0; elapsed < sweep;)
+        elapsed += scanMode == SCAN_BCM ? bcmStep() : spwmStep();
+
+    palClearLine(ledColumns[currentColumn]);
+}
+
+void led_multiplexing_startScan() {
+    startScan();
+}
+
+// The frame on display, or the one waiting for the next sweep, lights a key.
+bool led_multiplexing_isLit() {
+    return frontFrame->litColumns || (backFrameReady && backFrame->litColumns);
+}
+
+
+void led_multiplexing_setScanMode(ScanMode mode) {
+    if (mode > SCAN_BCM)
+        return;
+
+    // applied with the next compiled frame
+    requestedScanMode = mode;
+}
+
+ScanMode led_multiplexing_getScanMode() {
+    return scanMode;
+}
+
+/*
+ * Applied with the next compile of each column, the caller marks the keys
+ * it changes. scale: 0-256, undimmed: keys kept at full brightness or NULL.
+ */
+void led_multiplexing_setBrightness(uint16_t scale, const keyMask* undimmed) {
+#if LED_GAMMA_CORRECTION
+    brightnessLight = brightnessCurve[scale > 256 ? 256 : scale];
+#else
+    brightnessLight = (scale > 256 ? 256 : scale) << (GAMMA_TABLE_BITS - 8);
+#endif
+    undimmedKeys = undimmed;
+}
+
+void led_multiplexing_setDithering(bool enabled) {
+    // applied with the next compiled frame
+    requestedDithering = enabled;
+}
+
+//// ////
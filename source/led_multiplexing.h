@@ -1,4 +1,25 @@
 #pragma once
 
+#include "light_utils.h"
 
-void led_multiplexing_init(void);
\ No newline at end of file
+
+#define ALL_COLUMNS ((1 << NUM_COLUMN) - 1)
+
+typedef enum { SCAN_SPWM = 0, SCAN_BCM } ScanMode;
+
+void led_multiplexing_init(void);
+
+// changedColumns: bitmask of the columns that differ from the previous frame,
+// called every frame so mode switches apply to a still frame too
+void led_multiplexing_compileFrame(const led_t* leds, uint16_t changedColumns);
+void led_multiplexing_setScanMode(ScanMode mode);
+ScanMode led_multiplexing_getScanMode(void);
+void led_multiplexing_setBrightness(uint16_t scale, const keyMask* undimmed);
+void led_multiplexing_setDithering(bool enabled);
+
+// one full sweep run directly, only between stopScan and startScan
+void led_multiplexing_stopScan(void);
+void led_multiplexing_runSweep(void);
+void led_multiplexing_startScan(void);
+
+bool led_multiplexing_isLit(void);
@@ -4,16 +4,22 @@
 #include "string.h"
 #include "common_utils.h"
 #include "profiles.h"
+#include "led_multiplexing.h"
+#include "led_compositor.h"
+#include "led_stream.h"
+#include "key_events.h"
+#include "perf_stats.h"
+#include "miniFastLED.h"
 
 
 
 //// State ////
 
-static bool ledsNeedUpdate  = false;
 static bool ledState        = false;
 static bool ledTimeoutState = true; 
 static bool capsState       = false;
 static int brightness = 100;
+static uint16_t brightnessScale = 256; // brightness in 0-256, applied with a shift
 static bool gamingMode = false;
 static bool isLocked = false;
 static int8_t currentProfile = 0;
@@ -40,15 +46,33 @@ static bool bltLedOn = false;
 static systime_t bltLedLastSwitched = 0;
 /* */
 
+/*
+ * The dirty key mask belongs to the render thread. State changes coming
+ * from other threads only raise this flag, which makes the next frame
+ * rebuild every key.
+ */
+static volatile bool fullRefreshPending = true;
+
+static inline void requestFullRefresh(void) {
+    fullRefreshPending = true;
+}
+
+void refreshLeds(void) {
+    requestFullRefresh();
+}
+
 //// ////
 
 //// ANIMATION ////
 
 #define ANIMATION_TIMER_FREQUENCY   60
-#define FPS_TO_TIMEOUT(X) (ANIMATION_TIMER_FREQUENCY/X)
 
 static void animationCallback(GPTDriver* driver);
 
+static void executeOverlapEffect(uint32_t elapsed);
+static void executeOverlayEffects(uint32_t elapsed);
+static void executeProfile(uint32_t elapsed);
+
 
 // Lighting animation refresh timer
 static const GPTConfig lightAnimationConfig = {
@@ -57,22 +81,178 @@ static const GPTConfig lightAnimationConfig = {
 };
 
 
+//// Scheduler ////
+/*
+ * Every profile and effect keeps its own deadline accumulator in fixed-point
+ * system ticks (SCHED_FRAC_BITS fractional bits). Each frame it is advanced
+ * by the time elapsed since the previous frame, so any fps is honoured on
+ * average and dropped frames are caught up (up to SCHED_MAX_CATCHUP ticks).
+ */
+#define SCHED_FRAC_BITS     4
+#define SCHED_MAX_CATCHUP   4
+
+typedef struct {
+    uint8_t fps;
+    uint32_t period;
+    int32_t untilNext;
+} animSchedule;
+
+
+static void scheduleReset(animSchedule* schedule) {
+    schedule->untilNext = 0;
+}
+
+// Returns how many ticks are due. fps 0 never ticks.
+static uint8_t scheduleAdvance(animSchedule* schedule, uint8_t fps, uint32_t elapsed) {
+    if (fps == 0)
+        return 0;
+
+    if (fps != schedule->fps) {
+        schedule->fps = fps;
+        schedule->period = ((uint32_t)CH_CFG_ST_FREQUENCY << SCHED_FRAC_BITS) / fps;
+    }
+
+    schedule->untilNext -= elapsed;
+
+    uint8_t due = 0;
+    while (schedule->untilNext <= 0) {
+        schedule->untilNext += schedule->period;
+
+        if (++due == SCHED_MAX_CATCHUP) {
+            if (schedule->untilNext <= 0)
+                schedule->untilNext = schedule->period;
+            break;
+        }
+    }
+
+    return due;
+}
+
+static animSchedule profileSchedule;
+
+//// ////
+
+
+/*
+ * Rendering runs in its own thread, the BFTM1 interrupt only wakes it up.
+ * If the previous frame is still being rendered when the timer fires,
+ * that frame is dropped instead of queued, so a slow effect delays
+ * the animation but never the other interrupts.
+ */
+#define RENDER_EVENT        EVENT_MASK(0)
+#define BENCHMARK_EVENT     EVENT_MASK(1)
+#define RENDER_DEADLINE_US  (1000000 / ANIMATION_TIMER_FREQUENCY)
+
+static THD_WORKING_AREA(waRenderThread, 256);
+static thread_t* renderThread = NULL;
+static volatile bool renderBusy = false;
+// asleep: no frame is rendered or scanned until a command arrives
+static volatile bool renderIdle = false;
+static systime_t lastFrameTime;
+// held while a frame renders, and while a batch of commands is applied
+static MUTEX_DECL(stateMutex);
+
+
 static void animationCallback(GPTDriver* _driver) {
     (void)_driver;
-    static uint64_t tickCount = 0;
 
+    if (renderBusy) {
+        perf_countDroppedFrame();
+        return;
+    }
+
+    chSysLockFromISR();
+    chEvtSignalI(renderThread, RENDER_EVENT);
+    chSysUnlockFromISR();
+}
+
+// Renders a frame right away, from thread context.
+void requestRender(void) {
+    if (renderIdle)
+        perf_wakeRequested();
+
+    if (renderThread)
+        chEvtSignal(renderThread, RENDER_EVENT);
+}
+
+/*
+ * State changes made between these calls show up in the same frame.
+ * The render thread waits for endStateUpdate, so keep it short.
+ */
+void beginStateUpdate(void) {
+    chMtxLock(&stateMutex);
+}
+
+void endStateUpdate(void) {
+    chMtxUnlock(&stateMutex);
+}
+
+
+static void executeBenchmark(void);
+static bool canSleep(void);
+static void enterIdle(void);
+static void leaveIdle(void);
+
+
+static void renderFrame(uint32_t elapsed) {
     updateTimeout();
 
-    executeOverlapEffect(tickCount);
-    executeOverlapEffects(tickCount);
-    executeProfile(tickCount);
+    executeOverlapEffect(elapsed);
+    executeOverlayEffects(elapsed);
+    executeProfile(elapsed);
 
-    if (ledsNeedUpdate)
-        ledPostProcess();
+    ledPostProcess();
+}
+
+
+static THD_FUNCTION(RenderThread, arg) {
+    (void)arg;
+
+    while (true) {
+        eventmask_t events = chEvtWaitAny(RENDER_EVENT | BENCHMARK_EVENT);
+
+        // busy already while a command holds the state, a tick meanwhile is dropped
+        if (events & RENDER_EVENT)
+            renderBusy = true;
+        chMtxLock(&stateMutex);
+
+        if (events & BENCHMARK_EVENT) {
+            leaveIdle();
+            executeBenchmark();
+            lastFrameTime = chVTGetSystemTime();
+        }
+
+        if (!(events & RENDER_EVENT)) {
+            chMtxUnlock(&stateMutex);
+            continue;
+        }
+
+        // nothing moved while asleep, so there is nothing to catch up
+        bool waking = renderIdle;
+        if (waking) {
+            leaveIdle();
+            lastFrameTime = chVTGetSystemTime();
+        }
 
-    ledsNeedUpdate = false;
+        uint32_t renderStart = perf_cycleCount();
 
-    tickCount++;
+        systime_t now = chVTGetSystemTime();
+        renderFrame((uint32_t)(now - lastFrameTime) << SCHED_FRAC_BITS);
+        lastFrameTime = now;
+
+        uint32_t renderCycles = perf_cycleCount() - renderStart;
+        perf_recordRenderTime(renderCycles);
+        if (renderCycles > perf_usToCycles(RENDER_DEADLINE_US))
+            perf_countRenderOverrun();
+
+        if (waking)
+            perf_wakeFrameDone();
+        if (canSleep())
+            enterIdle();
+
+        renderBusy = false;
+        chMtxUnlock(&stateMutex);
+    }
 }
 
 
@@ -80,7 +260,10 @@ void led_anim_init() {
     led_state_init();
 
     executeInit();
-    executeProfile();
+    executeProfile(0);
+    lastFrameTime = chVTGetSystemTime();
+
+    renderThread = chThdCreateStatic(waRenderThread, sizeof(waRenderThread), NORMALPRIO + 1, RenderThread, NULL);
 
     gptStart(&GPTD_BFTM1, &lightAnimationConfig);
     gptStartContinuous(&GPTD_BFTM1, 1);
@@ -92,30 +275,19 @@ void led_anim_init() {
 
 //// Profiles ////
 
-static const Profile profiles[] = {
-    { 30, animatedRainbowFlow, 0, 0 },
-    { 30, prof_breathing_tick, prof_breathing_init, prof_breathing_pressed },
-    { REACTIVE_FPS,  prof_liveWeather_tick, prof_liveWeather_init, 0 },
-    { 30, prof_blink_tick, prof_blink_init, 0 },
-    { REACTIVE_FPS, prof_weatherShowoff_tick, prof_weatherShowoff_init, 0 }
+static const Profile* const profiles[] = {
+    &prof_rainbowFlow,
+    &prof_breathing,
+    &prof_liveWeather,
+    &prof_blink,
+    &prof_weatherShowoff
 };
 
-static const Profile lockedProfile = { 30, prof_locked_tick, prof_locked_init, 0 };
-static const uint8_t profileCount = sizeof(profiles)/sizeof(Profile);
-
-//// ////
-
+static const Profile* const lockedProfile = &prof_locked;
+static const uint8_t profileCount = LEN(profiles);
 
-//// Keypress ////
-
-typedef struct {
-  uint8_t col;
-  uint8_t row;
-} keypress;
-
-#define pressedKeysBuffSize 35
-static keypress pressedKeys[pressedKeysBuffSize];
-static uint8_t pressedKeyCnt = 0;
+// private state of the active profile
+static uint32_t profileState[PROFILE_STATE_SIZE / sizeof(uint32_t)];
 
 //// ////
 
@@ -123,8 +295,8 @@ static uint8_t pressedKeyCnt = 0;
 //// Led Maps ////
 
 static led_t ledColorsPost[70];
-static led_t ledFinal[70];
 static led_t ledColors[70];
+static led_t streamLedColors[70];
 
 //// ////
 
@@ -137,14 +309,55 @@ typedef enum {
     EFF_WEAVE_RED,
 } EffectEnum;
 
-static const Effect effects[] = {
-    [EFF_WEAVE_GREEN]  = { effect_weave_green_init, effect_weave_tick, 60 },
-    [EFF_WEAVE_YELLOW] = { effect_weave_yellow_init, effect_weave_tick, 60 },
-    [EFF_WEAVE_RED]    = { effect_weave_red_init, effect_weave_tick, 60 },
+static const Effect* const effects[] = {
+    [EFF_WEAVE_GREEN]  = &effect_weave_green,
+    [EFF_WEAVE_YELLOW] = &effect_weave_yellow,
+    [EFF_WEAVE_RED]    = &effect_weave_red,
 };
 
-Effect* getEffect(EffectEnum effect) {
-    return &effects[effect];
+const Effect* getEffect(EffectEnum effect) {
+    return effects[effect];
+}
+
+
+/*
+ * A running effect. Instances live in fixed pools (one overlap slot and
+ * the overlay slots), each with room for the effect's private state, so
+ * the same effect can run several times at once.
+ */
+typedef struct {
+    const Effect* effect;
+    animSchedule schedule;
+    uint32_t state[EFFECT_STATE_SIZE / sizeof(uint32_t)];
+} effectInstance;
+
+static bool startEffect(effectInstance* instance, const Effect* effect, led_t* ledColors) {
+    if (effect->stateSize > sizeof(instance->state))
+        return false;
+
+    instance->effect = effect;
+    scheduleReset(&instance->schedule);
+    memset(instance->state, 0, sizeof(instance->state));
+
+    if (effect->init) {
+        effect->init(ledColors, instance->state);
+    }
+
+    return true;
+}
+
+// Returns false once the effect is done.
+static bool advanceEffect(effectInstance* instance, uint32_t elapsed, bool* advanced) {
+    uint8_t due = scheduleAdvance(&instance->schedule, instance->effect->fps, elapsed);
+
+    for (; due > 0; due--) {
+        *advanced = true;
+
+        if (!instance->effect->tick(instance->state))
+            return false;
+    }
+
+    return true;
 }
 
 //// ////
@@ -160,38 +373,44 @@ Effect* getEffect(EffectEnum effect) {
 
 static led_t oneShotLedColors[70];
 
-Effect* overlapEffect = NULL;
+static effectInstance overlapInstance;
+static volatile bool overlapActive = false;
 
-void registerOverlapEffect(Effect* effect) {
+void registerOverlapEffect(const Effect* effect) {
     if (effect) {
-        memset(oneShotLedColors, 0, NUM_COLUMN * NUM_ROW * sizeof(led_t));
+        clearLedColors(oneShotLedColors);
 
-        overlapEffect = effect;
-        if (overlapEffect->init) {
-            overlapEffect->init(oneShotLedColors);
+        if (startEffect(&overlapInstance, effect, oneShotLedColors)) {
+            overlapActive = true;
+            requestFullRefresh();
         }
     }
 }
 
 bool overlapEffectIsActive() {
-    return overlapEffect != NULL;
+    return overlapActive;
 }
 
 void disableOverlapEffect() {
-    overlapEffect = NULL;
+    overlapActive = false;
+    requestFullRefresh();
 }
 
-Effect* getOverlapEffect() {
-    return overlapEffect;
+const Effect* getOverlapEffect() {
+    return overlapActive ? overlapInstance.effect : NULL;
 }
 
-void executeOverlapEffect(unsigned long tickCount) {
-    if (overlapEffectIsActive() && tickCount % FPS_TO_TIMEOUT(overlapEffect->fps) == 0) {
-        if (!overlapEffect->tick(oneShotLedColors)) {
-            disableOverlapEffect();
-        }
+static void executeOverlapEffect(uint32_t elapsed) {
+    if (!overlapEffectIsActive())
+        return;
 
-        ledsNeedUpdate = true;
+    bool advanced = false;
+    if (!advanceEffect(&overlapInstance, elapsed, &advanced)) {
+        disableOverlapEffect();
+    }
+    else if (advanced) {
+        clearLedColors(oneShotLedColors);
+        overlapInstance.effect->draw(oneShotLedColors, overlapInstance.state);
     }
 }
 
@@ -202,48 +421,268 @@ void executeOverlapEffect(unsigned long tickCount) {
 /*
  * Overlay effect is an one-shot animation that is rendered
  * on top of the profile layer and under the status indicator layer.
+ * Black overlay keys let the profile layer through.
  */
 
-#define overlayEffectsBufferSize 10
-Effect* overlayEffects[overlayEffectsBufferSize];
+#define overlayEffectsBufferSize 4
+static effectInstance overlayEffects[overlayEffectsBufferSize];
 static int overlayEffectCount = 0;
 
 static led_t overlayLedColors[70];
 
-void registerOverlayEffect(Effect* effect) {
+void registerOverlayEffect(const Effect* effect) {
     if (overlayEffectCount < overlayEffectsBufferSize) {
-        overlayEffects[overlayEffectCount++] = effect;
-        if (effect->init) {
-            effect->init(overlayLedColors);
-        }
+        if (startEffect(&overlayEffects[overlayEffectCount], effect, overlayLedColors))
+            overlayEffectCount++;
     }
 }
 
-void executeOverlayEffects(unsigned long tickCount) {
-    memset(overlayLedColors, 0, NUM_COLUMN * NUM_ROW * sizeof(led_t));
+/*
+ * All overlays share one buffer. Whenever one of them moves, the buffer
+ * is cleared and every overlay draws its current step again.
+ */
+static void executeOverlayEffects(uint32_t elapsed) {
+    bool advanced = false;
 
     for (int i = 0; i < overlayEffectCount; i++) {
-        if (tickCount % FPS_TO_TIMEOUT(overlayEffects[i]->fps) == 0) {
-            if (!overlayEffects[i]->tick(ledColorsPost)) {
-                for (int j = i; j < overlayEffectCount - 1; j++) {
-                    overlayEffects[j] = overlayEffects[j+1];
-                }
-
-                i--;
-                overlayEffectCount--;
+        if (!advanceEffect(&overlayEffects[i], elapsed, &advanced)) {
+            for (int j = i; j < overlayEffectCount - 1; j++) {
+                overlayEffects[j] = overlayEffects[j+1];
             }
 
-            for(int y = 0; y < NUM_ROW; y++) {
-                for (int x = 0; x < NUM_COLUMN; x++) {
-                    int idx = y * NUM_COLUMN + x;
-                    if (overlayLedColors[idx].red == 0 && overlayLedColors[idx].green == 0 && overlayLedColors[idx].blue == 0) {
-                        overlayLedColors[idx] = ledColorsPost[idx];
-                        ledsNeedUpdate = true;
-                    }
-                }
+            i--;
+            overlayEffectCount--;
+            advanced = true;
+        }
+    }
+
+    if (advanced) {
+        clearLedColors(overlayLedColors);
+
+        for (int i = 0; i < overlayEffectCount; i++) {
+            overlayEffects[i].effect->draw(overlayLedColors, overlayEffects[i].state);
+        }
+    }
+}
+
+//// ////
+
+
+//// Low-power Idle ////
+/*
+ * Once the LEDs are off or timed out and the frame is dark, the animation
+ * and scan timers are stopped and the LED supply is cut. The render
+ * thread then waits for a command, so the CPU only wakes up from WFI for
+ * the system tick and the UART. Every command wakes it up again for at
+ * least one frame, see wakeRendering.
+ */
+
+// Nothing is lit, and nothing would light up without a command.
+static bool canSleep(void) {
+    return mainInitDone
+        && !(ledState && ledTimeoutState)
+        && !led_stream_isEnabled()
+        && !overlapActive
+        && overlayEffectCount == 0
+        && bltState == 0
+        && numToDisplayIdx < 0
+        && !led_multiplexing_isLit();
+}
+
+static void enterIdle(void) {
+    gptStopTimer(&GPTD_BFTM1);
+    led_multiplexing_stopScan();
+    palClearLine(LINE_LED_PWR);
+
+    renderIdle = true;
+    perf_sleepEntered();
+}
+
+static void leaveIdle(void) {
+    if (!renderIdle)
+        return;
+
+    perf_sleepLeft();
+    renderIdle = false;
+
+    palSetLine(LINE_LED_PWR);
+    led_multiplexing_startScan();
+    gptStartContinuous(&GPTD_BFTM1, 1);
+}
+
+// Called by the serial thread after every command.
+void wakeRendering(void) {
+    if (renderIdle)
+        requestRender();
+}
+
+//// ////
+
+
+//// Benchmark ////
+/*
+ * Runs in the render thread with the state locked and both the animation
+ * and the scan timer stopped, so nothing else is rendered or scanned and
+ * only SysTick and UART interrupts can add to a measurement. Every call is
+ * timed on its own, minus the cost of reading the cycle counter.
+ *
+ * The profile ticks and effects draw into the profile buffers, so the
+ * current profile starts over once the benchmark is done.
+ */
+// the serial thread's EVENT_MASK(0) is taken by the UART error listener
+#define BENCHMARK_DONE_EVENT    EVENT_MASK(1)
+
+// the animations the live weather profile plays, not in profiles[]
+static const Profile* const weatherProfiles[] = {
+    &prof_snowing,
+    &prof_storm,
+    &prof_rain,
+    &prof_cloudy,
+    &prof_stars
+};
+
+_Static_assert(LEN(profiles) + LEN(weatherProfiles) + LEN(effects) + 3 == BENCH_RESULT_COUNT,
+               "benchmark result count out of date");
+
+static benchResult benchResults[BENCH_RESULT_COUNT];
+static uint16_t benchIterations;
+static uint32_t benchOverhead;
+static thread_t* benchRequester;
+
+static void benchBegin(benchResult* result, BenchTarget target, uint8_t index) {
+    result->target = target;
+    result->index = index;
+    result->minCycles = UINT32_MAX;
+    result->avgCycles = 0;
+    result->maxCycles = 0;
+}
+
+static void benchRecord(benchResult* result, uint32_t startCycles) {
+    uint32_t cycles = perf_cycleCount() - startCycles;
+    cycles = cycles > benchOverhead ? cycles - benchOverhead : 0;
+
+    if (cycles < result->minCycles)
+        result->minCycles = cycles;
+    if (cycles > result->maxCycles)
+        result->maxCycles = cycles;
+    // the sum, divided once all iterations ran
+    result->avgCycles += cycles;
+}
+
+static void benchEnd(benchResult* result) {
+    result->avgCycles /= benchIterations;
+}
+
+static void benchProfile(benchResult* result, BenchTarget target, uint8_t index, const Profile* profile) {
+    benchBegin(result, target, index);
+    clearLedColors(ledColors);
+    memset(profileState, 0, sizeof(profileState));
+    if (profile->init)
+        profile->init(ledColors, profileState);
+
+    for (uint16_t i = 0; profile->tick && i < benchIterations; i++) {
+        uint32_t start = perf_cycleCount();
+        profile->tick(ledColors, profileState);
+        benchRecord(result, start);
+    }
+    benchEnd(result);
+}
+
+
+static void executeBenchmark(void) {
+    benchResult* result = benchResults;
+
+    gptStopTimer(&GPTD_BFTM1);
+    led_multiplexing_stopScan();
+
+    benchOverhead = UINT32_MAX;
+    for (uint16_t i = 0; i < benchIterations; i++) {
+        uint32_t cycles = perf_cycleCount();
+        cycles = perf_cycleCount() - cycles;
+        if (cycles < benchOverhead)
+            benchOverhead = cycles;
+    }
+
+    for (uint8_t p = 0; p < profileCount; p++)
+        benchProfile(result++, BENCH_PROFILE, p, profiles[p]);
+
+    for (uint8_t w = 0; w < LEN(weatherProfiles); w++)
+        benchProfile(result++, BENCH_WEATHER, w, weatherProfiles[w]);
+
+    // an effect frame is a tick and a draw, one-shots restart when done
+    for (uint8_t e = 0; e < LEN(effects); e++, result++) {
+        const Effect* effect = effects[e];
+
+        benchBegin(result, BENCH_EFFECT, e);
+        memset(profileState, 0, sizeof(profileState));
+        effect->init(ledColors, profileState);
+
+        for (uint16_t i = 0; i < benchIterations; i++) {
+            uint32_t start = perf_cycleCount();
+            bool running = effect->tick(profileState);
+            effect->draw(ledColors, profileState);
+            benchRecord(result, start);
+
+            if (!running) {
+                memset(profileState, 0, sizeof(profileState));
+                effect->init(ledColors, profileState);
             }
         }
+        benchEnd(result);
+    }
+
+    // every key composed and every column compiled
+    benchBegin(result, BENCH_POST_PROCESS, 0);
+    for (uint16_t i = 0; i < benchIterations; i++) {
+        requestFullRefresh();
+
+        uint32_t start = perf_cycleCount();
+        ledPostProcess();
+        benchRecord(result, start);
+    }
+    benchEnd(result++);
+
+    benchBegin(result, BENCH_HSV2RGB, 0);
+    for (uint16_t i = 0; i < benchIterations; i++) {
+        uint8_t rgb[3];
+
+        uint32_t start = perf_cycleCount();
+        hsv2rgb(i, 255, 255, rgb);
+        benchRecord(result, start);
     }
+    benchEnd(result++);
+
+    benchBegin(result, BENCH_SCAN_SWEEP, led_multiplexing_getScanMode());
+    for (uint16_t i = 0; i < benchIterations; i++) {
+        uint32_t start = perf_cycleCount();
+        led_multiplexing_runSweep();
+        benchRecord(result, start);
+    }
+    benchEnd(result);
+
+    executeInit();
+    led_multiplexing_startScan();
+    gptStartContinuous(&GPTD_BFTM1, 1);
+
+    chEvtSignal(benchRequester, BENCHMARK_DONE_EVENT);
+}
+
+/*
+ * Blocks the calling thread until the render thread has run every
+ * benchmark iterations times (1 to BENCH_MAX_ITERATIONS).
+ * Must not be called with the state locked.
+ */
+uint8_t runBenchmark(uint16_t iterations, const benchResult** results) {
+    if (!renderThread)
+        return 0;
+
+    benchIterations = iterations;
+    benchRequester = chThdGetSelfX();
+    chEvtSignal(renderThread, BENCHMARK_EVENT);
+    chEvtWaitAny(BENCHMARK_DONE_EVENT);
+
+    *results = benchResults;
+    return BENCH_RESULT_COUNT;
 }
 
 //// ////
@@ -253,11 +692,11 @@ void mainInitDoneCallback(void) {
     mainInitDone = true;
 }
 
-Profile* getCurrentProfile() {
+const Profile* getCurrentProfile() {
     if (isLocked)
-        return &lockedProfile;
+        return lockedProfile;
     else
-        return &profiles[currentProfile];
+        return profiles[currentProfile];
 }
 
 uint8_t getCurrentProfileIndex() {
@@ -282,10 +721,12 @@ void prevProfile() {
 
 void disableLeds() {
     ledState = false;
+    requestFullRefresh();
 }
 
 void enableLeds(){
     ledState = true;
+    requestFullRefresh();
 }
 
 
@@ -302,144 +743,243 @@ void updateTimeout() {
     if (powerPlan == POWER_MAX) {
         ledTimeoutState = true;
     }
+    else if (led_stream_isEnabled()) {
+        // the host is driving the LEDs, that counts as activity
+        lastKeypress = sysTimeMs();
+
+        if (!ledTimeoutState) {
+            ledTimeoutState = true;
+            requestFullRefresh();
+        }
+    }
     else if (ledTimeoutState) {
         int ledTimeout = (powerPlan == POWER_BATT) ?
             LED_TIMEOUT_BATTERY : LED_TIMEOUT_USB;
 
         if (sysTimeMs() - lastKeypress >= ledTimeout * 1000) {
             ledTimeoutState = false;
-            memset(ledColors, 0, NUM_COLUMN * NUM_ROW * sizeof(led_t));
+            clearLedColors(ledColors);
+            requestFullRefresh();
         }
     }
 }
 
-void ledPostProcess() {
-    if (overlapEffectIsActive()) {
-        memcpy(ledColorsPost, oneShotLedColors, NUM_COLUMN * NUM_ROW * sizeof(led_t));
-    }
-    else if(ledState && ledTimeoutState && numToDisplayIdx < 0) {
-        memcpy(ledColorsPost, ledColors, NUM_COLUMN * NUM_ROW * sizeof(led_t));
-    }
-    else {
-        memset(ledColorsPost, 0, NUM_COLUMN * NUM_ROW * sizeof(led_t));
+//// Layers ////
+/*
+ * Bottom to top: profile or host stream, overlap effect, overlay effects
+ * and status indicators. Which layers are enabled only changes together
+ * with a full refresh, so updateLayers() runs on those frames only.
+ * Brightness dims everything but the indicators in the frame compile,
+ * at the precision of the gamma table.
+ */
+
+static ledLayer profileLayer = {
+    .type = LAYER_DENSE, .blend = BLEND_REPLACE, .opacity = LAYER_OPAQUE,
+    .dense = { ledColors, NULL }
+};
+
+static ledLayer streamLayer = {
+    .type = LAYER_DENSE, .blend = BLEND_REPLACE, .opacity = LAYER_OPAQUE,
+    .dense = { streamLedColors, NULL }
+};
+
+static ledLayer overlapLayer = {
+    .type = LAYER_DENSE, .blend = BLEND_REPLACE, .opacity = LAYER_OPAQUE,
+    .dense = { oneShotLedColors, NULL }
+};
+
+static ledLayer overlayLayer = {
+    .type = LAYER_DENSE, .blend = BLEND_REPLACE, .opacity = LAYER_OPAQUE,
+    .blackIsTransparent = true,
+    .dense = { overlayLedColors, NULL }
+};
+
+// caps, bluetooth, 4 gaming arrows and a digit
+#define INDICATOR_COUNT 7
+static sparseLed indicatorLeds[INDICATOR_COUNT];
+
+static ledLayer indicatorLayer = {
+    .type = LAYER_SPARSE, .blend = BLEND_REPLACE, .opacity = LAYER_OPAQUE,
+    .sparse = { indicatorLeds, INDICATOR_COUNT, 0, { { 0 } } }
+};
+
+
+static const uint8_t capsKey = 28;
+static const uint8_t gamingArrows[] = { 54, 66, 67, 68 };
+
+// Rebuilds the indicator layer, the keys it adds or drops get marked.
+static void buildIndicators(void) {
+    led_layer_clearKeys(&indicatorLayer);
+
+    static const led_t capsColor = { 255, 25, 25 };
+    if (capsState) {
+        led_layer_setKey(&indicatorLayer, capsKey, &capsColor);
     }
 
 
-    if (!isLocked) {
-        for (int i = 0; i < NUM_COLUMN * NUM_ROW; i++) {
-            if (!(overlayLedColors[i].red == 0 && overlayLedColors[i].green == 0 && overlayLedColors[i].blue == 0)) {
-                ledColorsPost[i] = overlayLedColors[i];
-            }
-        }
+    static const led_t bltColor = {0, 255, 30};
+    if (bltState && bltLedOn) {
+        led_layer_setKey(&indicatorLayer, ((bltState - 1) & 3) + 1, &bltColor);
+    }
 
 
-        if (brightness < 100) {
-            for (int i = 0; i < NUM_COLUMN * NUM_ROW; i++) {
-                ledColorsPost[i].red = (ledColorsPost[i].red * brightness) / 100;
-                ledColorsPost[i].green = (ledColorsPost[i].green * brightness) / 100;
-                ledColorsPost[i].blue = (ledColorsPost[i].blue * brightness) / 100;
-            }
+    static const led_t gamingArrowLedColor = { 110, 5, 5 };
+    if (gamingMode) {
+        for (uint8_t i = 0; i < LEN(gamingArrows); i++) {
+            led_layer_setKey(&indicatorLayer, gamingArrows[i], &gamingArrowLedColor);
         }
+    }
 
 
-        static const led_t capsColor = { 255, 25, 25 };
-        if (capsState) {
-            ledColorsPost[28] = capsColor;  
-        }
+    if (numToDisplayIdx >= 0 && numDisplayOn) {
+        int8_t digitIdx = numToDisplay[numToDisplayIdx];
+
+        if (digitIdx == 0) 
+            digitIdx = 10;
+        else if (digitIdx == -1)
+            digitIdx = 11;
+        else if (digitIdx < -1 || digitIdx > 9)
+            digitIdx = 0;
 
+        led_layer_setKey(&indicatorLayer, digitIdx, &numDisplayColor);
+    }
+}
 
-        static const led_t bltColor = {0, 255, 30};
-        if (bltState) {
-            systime_t bltLedRate = bltState <= 4 ? bltConnBlinkSpeed : bltBroadBlinkSpeed;
+// Advances the blinking indicators, returns true if one of them toggled.
+static bool updateIndicators(void) {
+    bool changed = false;
 
-            if (sysTimeMs() - bltLedLastSwitched > bltLedRate) {
-                bltLedOn = !bltLedOn;
-                bltLedLastSwitched = sysTimeMs();
-            }
+    if (bltState) {
+        systime_t bltLedRate = bltState <= 4 ? bltConnBlinkSpeed : bltBroadBlinkSpeed;
 
-            if (bltLedOn)
-                ledColorsPost[(bltState - 1) % 4 + 1] = bltColor;
+        if (sysTimeMs() - bltLedLastSwitched > bltLedRate) {
+            bltLedOn = !bltLedOn;
+            bltLedLastSwitched = sysTimeMs();
+            changed = true;
         }
+    }
 
 
-        static const uint8_t gamingArrows[] = { 54, 66, 67, 68 };
-        static const led_t gamingArrowLedColor = { 110, 5, 5 };
-        if (gamingMode) {
-            for (uint8_t i = 0; i < LEN(gamingArrows); i++) {
-                ledColorsPost[gamingArrows[i]] = gamingArrowLedColor;
+    if (numToDisplayIdx >= 0) {
+        if (sysTimeMs() - numDisplayLastSwitched > numDisplaySpeed) {
+            numDisplayOn = !numDisplayOn;
+            numDisplayLastSwitched = sysTimeMs();
+            changed = true;
+
+            if (numDisplayOn == false) {
+                numToDisplayIdx--;
+
+                // the profile layer comes back
+                if (numToDisplayIdx < 0)
+                    requestFullRefresh();
             }
         }
+    }
+
+    return changed;
+}
 
+static void updateLayers(void) {
+    bool baseVisible = !overlapEffectIsActive() && ledState && ledTimeoutState && numToDisplayIdx < 0;
+    profileLayer.enabled = baseVisible && !led_stream_isEnabled();
+    streamLayer.enabled = baseVisible && led_stream_isEnabled();
+    overlapLayer.enabled = overlapEffectIsActive();
+    overlayLayer.enabled = !isLocked;
+    indicatorLayer.enabled = !isLocked;
 
-        if (numToDisplayIdx >= 0) {
-            if (sysTimeMs() - numDisplayLastSwitched > numDisplaySpeed) {
-                numDisplayOn = !numDisplayOn;
-                numDisplayLastSwitched = sysTimeMs();
+    led_multiplexing_setBrightness(isLocked ? 256 : brightnessScale, &indicatorLayer.sparse.keys);
+}
 
-                if (numDisplayOn == false) {
-                    numToDisplayIdx--;
-                }
-            }
+static void initLayers(void) {
+    led_compositor_init();
+    led_compositor_addLayer(&profileLayer);
+    led_compositor_addLayer(&streamLayer);
+    led_compositor_addLayer(&overlapLayer);
+    led_compositor_addLayer(&overlayLayer);
+    led_compositor_addLayer(&indicatorLayer);
+}
+
+//// ////
 
 
-            if (numDisplayOn) {
-                int8_t digitIdx = numToDisplay[numToDisplayIdx];
+/*
+ * Only keys marked in ledDirtyKeys are composed, and only the columns
+ * holding them are recompiled. A frame without changes costs nothing.
+ */
+void ledPostProcess() {
+    led_stream_update();
+    led_stream_present(streamLedColors);
 
-                if (digitIdx == 0) 
-                    digitIdx = 10;
-                else if (digitIdx == -1)
-                    digitIdx = 11;
-                else if (digitIdx < -1 || digitIdx > 9)
-                    digitIdx = 0;
+    bool indicatorsChanged = updateIndicators();
 
-                ledColorsPost[digitIdx] = numDisplayColor;
-            }
-        }
+    if (fullRefreshPending) {
+        fullRefreshPending = false;
+        markAllKeysDirty();
+        updateLayers();
+        indicatorsChanged = true;
     }
 
-    memcpy(ledFinal, ledColorsPost, NUM_COLUMN * NUM_ROW * sizeof(led_t));
+    if (indicatorsChanged)
+        buildIndicators();
+
+    uint16_t dirtyColumns = anyKeyDirty() ? led_compositor_compose(ledColorsPost) : 0;
+    led_multiplexing_compileFrame(ledColorsPost, dirtyColumns);
 }
 
 
 void led_state_init() {
     lastKeypress = sysTimeMs();
-    memset(ledColors, 0, NUM_COLUMN * NUM_ROW * sizeof(led_t));
+    clearLedColors(ledColors);
+    initLayers();
+    requestFullRefresh();
 }
 
 
 void bltConnected() {
     bltState = 0;
+    requestFullRefresh();
 }
 
 void bltConnecting(uint8_t state) {
     bltState = state;
+    requestFullRefresh();
 
     bltLedOn = true;
     bltLedLastSwitched = sysTimeMs();
 }
 
+static void updateBrightnessScale(void) {
+    brightnessScale = brightness >= 100 ? 256 : (brightness * 256 + 50) / 100;
+    requestFullRefresh();
+}
+
 void brightnessDown() {
     brightness -= 20;
     if (brightness < 20)
         brightness = 20;
+    updateBrightnessScale();
 }
 
 void brightnessUp() {
     brightness += 20;
     if (brightness > 100)
         brightness = 100;
+    updateBrightnessScale();
 }
 
 void setBrightness(uint8_t bn) {
     brightness = bn;
+    updateBrightnessScale();
 }
 
 void setGamingMode(bool mode) {
     gamingMode = mode;
+    requestFullRefresh();
 }
 
 void setCapsState(bool state) {
     capsState = state;
+    requestFullRefresh();
 }
 
 int16_t getBrightness(void) {
@@ -447,19 +987,43 @@ int16_t getBrightness(void) {
 }
 
 
-void keyPressedCallback(uint8_t keyPos) {
+static void keyActivity(void) {
     lastKeypress = sysTimeMs();
 
     if (ledTimeoutState == false) {
         executeInit();
         ledTimeoutState = true;
+        requestFullRefresh();
     }
+}
 
-    if (pressedKeyCnt < pressedKeysBuffSize) {
-        pressedKeys[pressedKeyCnt].row = keyPos & 0xF;
-        pressedKeys[pressedKeyCnt].col = (keyPos >> 4) & 0xF; 
-        pressedKeyCnt++;
-    }
+/*
+ * Key events are rendered right away instead of on the profile's next
+ * tick. The render thread preempts the serial thread, and only the keys
+ * the profile changes are composed and compiled.
+ */
+static void renderKeyEvent(void) {
+    perf_keyEventReceived();
+    requestRender();
+}
+
+// keyPos: col (4 bits) + row (4 bits)
+void keyPressedCallback(uint8_t keyPos) {
+    keyActivity();
+    key_events_push(keyPos >> 4, keyPos & 0xF, KEY_EVENT_PRESSED | KEY_EVENT_TAP, key_events_now());
+    renderKeyEvent();
+}
+
+void keyEventCallback(uint8_t keyPos, uint8_t flags, uint16_t time) {
+    if (flags & KEY_EVENT_PRESSED)
+        keyActivity();
+
+    key_events_push(keyPos >> 4, keyPos & 0xF, flags & KEY_EVENT_PRESSED, time);
+    renderKeyEvent();
+}
+
+void keyMatrixCallback(const uint8_t* bitmap, uint16_t time) {
+    key_events_setMatrix(bitmap, time);
 }
 
 void setPowerPlan(PowerPlan pp) {
@@ -488,52 +1052,76 @@ void setPowerPlan(PowerPlan pp) {
 
 void setLocked(bool locked) {
     isLocked = locked;
+    requestFullRefresh();
 }
 
 uint8_t getProfileCount(void) {
     return profileCount;
 }
 
-void executeProfile(unsigned long tickCount) {
+static void executeProfile(uint32_t elapsed) {
     uint8_t profileFps = getCurrentProfile()->fps;
     if (profileFps == REACTIVE_FPS) {
         profileFps = getReactiveFps();
     }
-    
-    if (tickCount % FPS_TO_TIMEOUT(profileFps) == 0) {
-        if (ledState && ledTimeoutState)  {
+
+    uint8_t due = scheduleAdvance(&profileSchedule, profileFps, elapsed);
+    if (due) {
+        if (ledState && ledTimeoutState && !led_stream_isEnabled())  {
             anim_tick tick = getCurrentProfile()->tick;
-            if (tick) tick(ledColors);
+            for (; tick && due > 0; due--) {
+                tick(ledColors, profileState);
+            }
         }
+    }
 
-        executeKeypress();
+    // every frame, a key event requests one right away
+    executeKeypress();
+}
 
-        ledsNeedUpdate = true;
+void executeInit() {
+    scheduleReset(&profileSchedule);
+    clearLedColors(ledColors);
+    memset(profileState, 0, sizeof(profileState));
+    anim_init init = getCurrentProfile()->init;
+    if (init) {
+        init(ledColors, profileState);
     }
+
+    requestFullRefresh();
 }
 
-void executeInit() {
-    memset(ledColors, 0, NUM_COLUMN * NUM_ROW * sizeof(led_t));
+/*
+ * Runs the current profile's init again on its running state, for
+ * settings a profile can pick up without starting over (live weather).
+ */
+void reconfigureProfile() {
     anim_init init = getCurrentProfile()->init;
     if (init) {
-        init(ledColors);
+        init(ledColors, profileState);
     }
+
+    requestFullRefresh();
 }
 
 void executeKeypress() {
-    anim_keypress callback = getCurrentProfile()->keypress;
-    if (callback) {
-        for (uint8_t i = 0; i < pressedKeyCnt; i++) {
-            callback(pressedKeys[i].col, pressedKeys[i].row, ledColors);
+    const Profile* profile = getCurrentProfile();
+    keyEvent event;
+
+    while (key_events_pop(&event)) {
+        if (event.flags & KEY_EVENT_PRESSED) {
+            if (profile->keypress)
+                profile->keypress(event.col, event.row, ledColors, profileState);
+        }
+        else if (profile->keyrelease) {
+            profile->keyrelease(event.col, event.row, event.held, ledColors, profileState);
         }
     }
-
-    pressedKeyCnt = 0;
 }
 
 
 led_t* getLedsToDisplay() {
-    return ledFinal;
+    return ledColorsPost;
 }
 
 
@@ -559,6 +1147,7 @@ void displayNumber(int value) {
         numToDisplay[numToDisplayIdx++] = -1;
 
     numDisplayOn = true;
+    requestFullRefresh();
 }
 
 void displayNumberColored(int value, led_t color) {
@@ -570,6 +1159,7 @@ void displayNumberColored(int value, led_t color) {
 static void displayInvalidNumber(void) {
     numToDisplayIdx = 0;
     numToDisplay[0] = -10;
+    requestFullRefresh();
 }
 
 void displayTemp(void) {
@@ -594,5 +1184,6 @@ void displayTime(void) {
     numDisplayColor = green;
     
     numToDisplayIdx = 3;
+    requestFullRefresh();
 }
 
@@ -4,6 +4,11 @@
 #include "profiles.h"
 
 void led_anim_init(void);
+void requestRender(void);
+void wakeRendering(void);
+void refreshLeds(void);
+void beginStateUpdate(void);
+void endStateUpdate(void);
 
 typedef enum { POWER_BATT, POWER_USB, POWER_MAX } PowerPlan;
 
@@ -24,9 +29,11 @@ void setGamingMode(bool mode);
 void setCapsState(bool state);
 int16_t getBrightness(void);
 void keyPressedCallback(uint8_t keyPos);
+void keyEventCallback(uint8_t keyPos, uint8_t flags, uint16_t time);
+void keyMatrixCallback(const uint8_t* bitmap, uint16_t time);
 void setPowerPlan(PowerPlan pp);
 void setLocked(bool locked);
-Profile* getCurrentProfile(void);
+const Profile* getCurrentProfile(void);
 uint8_t getProfileCount(void);
 uint8_t getCurrentProfileIndex(void);
 void ledPostProcess(void);
@@ -35,13 +42,41 @@ void displayTemp(void);
 void displayTime(void);
 
 void executeInit(void);
+void reconfigureProfile(void);
 void executeKeypress(void);
 
 void updateTimeout(void);
 
 void displayNumber(int value);
 
-void registerOverlapEffect(Effect* effect);
+typedef enum {
+    BENCH_PROFILE = 0,
+    BENCH_EFFECT,
+    BENCH_POST_PROCESS,
+    BENCH_HSV2RGB,
+    BENCH_SCAN_SWEEP,
+    BENCH_WEATHER
+} BenchTarget;
+
+// cycles per call; index is the profile, the effect, the scan mode or
+// the weather animation (snow, storm, rain, cloudy, stars)
+typedef struct {
+    uint8_t target;
+    uint8_t index;
+    uint32_t minCycles;
+    uint32_t avgCycles;
+    uint32_t maxCycles;
+} benchResult;
+
+// every profile, weather animation and effect, ledPostProcess, hsv2rgb
+// and one scan sweep
+#define BENCH_RESULT_COUNT 16
+// keeps the cycle sums of the slowest calls in 32 bits
+#define BENCH_MAX_ITERATIONS 1000
+
+uint8_t runBenchmark(uint16_t iterations, const benchResult** results);
+
+void registerOverlapEffect(const Effect* effect);
 bool overlapEffectIsActive(void);
-Effect* getOverlapEffect(void);
+const Effect* getOverlapEffect(void);
 
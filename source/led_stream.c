@@ -0,0 +1,179 @@
+#include "led_stream.h"
+#include "led_state.h"
+#include "common_utils.h"
+#include "string.h"
+
+
+// Without a frame for this long the profile takes over again.
+#define STREAM_TIMEOUT_MS 3000
+
+static led_t stagingColors[NUM_KEYS];
+static volatile bool streamEnabled = false;
+static volatile bool framePending = false;
+static systime_t lastShown;
+
+static const uint8_t bytesPerKey[STREAM_FORMAT_COUNT] = {
+    [STREAM_RGB888] = 3,
+    [STREAM_RGB565] = 2,
+    [STREAM_RGB332] = 1,
+};
+
+
+void led_stream_setEnabled(bool enabled) {
+    if (enabled == streamEnabled)
+        return;
+
+    framePending = false;
+    lastShown = sysTimeMs();
+    memset(stagingColors, 0, sizeof(stagingColors));
+    streamEnabled = enabled;
+
+    refreshLeds();
+}
+
+bool led_stream_isEnabled() {
+    return streamEnabled;
+}
+
+
+// Expands the compact formats to the full 0-255 range.
+static void decodeKey(StreamFormat format, const uint8_t* data, led_t* color) {
+    switch (format) {
+    case STREAM_RGB565: {
+        uint16_t value = data[0] | (data[1] << 8);
+        uint8_t r = value >> 11, g = (value >> 5) & 0x3F, b = value & 0x1F;
+
+        color->red = (r << 3) | (r >> 2);
+        color->green = (g << 2) | (g >> 4);
+        color->blue = (b << 3) | (b >> 2);
+        break;
+    }
+
+    case STREAM_RGB332: {
+        uint8_t r = data[0] >> 5, g = (data[0] >> 2) & 0x7, b = data[0] & 0x3;
+
+        color->red = (r << 5) | (r << 2) | (r >> 1);
+        color->green = (g << 5) | (g << 2) | (g >> 1);
+        color->blue = b * 0x55;
+        break;
+    }
+
+    case STREAM_RGB888:
+    default:
+        color->red = data[0];
+        color->green = data[1];
+        color->blue = data[2];
+        break;
+    }
+}
+
+// Keys past the end of the keyboard are ignored.
+static void decodeRaw(StreamFormat format, const uint8_t* data, uint8_t length) {
+    uint8_t step = bytesPerKey[format];
+    uint8_t key = *data++;
+    length--;
+
+    for (; length >= step && key < NUM_KEYS; length -= step, data += step, key++) {
+        decodeKey(format, data, &stagingColors[key]);
+    }
+}
+
+static void decodeDelta(StreamFormat format, const uint8_t* data, uint8_t length) {
+    uint8_t step = bytesPerKey[format];
+    const uint8_t* bitmap = data;
+
+    if (length < STREAM_BITMAP_SIZE)
+        return;
+
+    data += STREAM_BITMAP_SIZE;
+    length -= STREAM_BITMAP_SIZE;
+
+    for (uint8_t key = 0; key < NUM_KEYS && length >= step; key++) {
+        if (bitmap[key >> 3] & (1 << (key & 7))) {
+            decodeKey(format, data, &stagingColors[key]);
+            data += step;
+            length -= step;
+        }
+    }
+}
+
+static void decodeRle(StreamFormat format, const uint8_t* data, uint8_t length) {
+    uint8_t step = bytesPerKey[format] + 1;
+    uint8_t key = *data++;
+    length--;
+
+    for (; length >= step && key < NUM_KEYS; length -= step, data += step) {
+        led_t color;
+        decodeKey(format, data + 1, &color);
+
+        for (uint8_t count = data[0]; count > 0 && key < NUM_KEYS; count--, key++)
+            stagingColors[key] = color;
+    }
+}
+
+// data: format byte followed by the encoded keys
+bool led_stream_writeKeys(const uint8_t* data, uint8_t length) {
+    if (!streamEnabled || length < 2)
+        return false;
+
+    StreamFormat format = data[0] & STREAM_FORMAT_MASK;
+    StreamEncoding encoding = (data[0] & STREAM_ENCODING_MASK) >> STREAM_ENCODING_SHIFT;
+    bool show = data[0] & STREAM_SHOW_FLAG;
+
+    if (format >= STREAM_FORMAT_COUNT)
+        return false;
+
+    switch (encoding) {
+    case STREAM_RAW:
+        decodeRaw(format, data + 1, length - 1);
+        break;
+
+    case STREAM_DELTA:
+        decodeDelta(format, data + 1, length - 1);
+        break;
+
+    case STREAM_RLE:
+        decodeRle(format, data + 1, length - 1);
+        break;
+
+    default:
+        return false;
+    }
+
+    if (show)
+        led_stream_show();
+
+    return true;
+}
+
+/*
+ * The render thread runs at a higher priority than the serial thread, so
+ * it picks the frame up before the next key write can touch the staging
+ * frame.
+ */
+void led_stream_show() {
+    if (!streamEnabled)
+        return;
+
+    framePending = true;
+    requestRender();
+}
+
+
+void led_stream_update() {
+    if (streamEnabled && sysTimeMs() - lastShown > STREAM_TIMEOUT_MS)
+        led_stream_setEnabled(false);
+}
+
+// Copies a completed frame into the stream layer, returns true if there was one.
+bool led_stream_present(led_t* ledColors) {
+    if (!framePending)
+        return false;
+
+    for (uint8_t i = 0; i < NUM_KEYS; i++)
+        setLedColor(ledColors, i, &stagingColors[i]);
+
+    framePending = false;
+    lastShown = sysTimeMs();
+    return true;
+}
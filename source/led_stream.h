@@ -0,0 +1,49 @@
+#pragma once
+
+#include "light_utils.h"
+
+
+/*
+ * Host driven frames. The host writes key colors into a staging frame
+ * and marks the frame complete, only complete frames are shown.
+ * While streaming, the profile is not rendered.
+ */
+typedef enum {
+    STREAM_RGB888 = 0,  // 3 bytes per key: r, g, b
+    STREAM_RGB565,      // 2 bytes per key, little endian
+    STREAM_RGB332,      // 1 byte per key
+    STREAM_FORMAT_COUNT
+} StreamFormat;
+
+/*
+ * How the keys are sent, after the format byte:
+ *  STREAM_RAW:   first key, colors of the following keys
+ *  STREAM_DELTA: bitmap of the changed keys (key i is bit i & 7 of byte
+ *                i >> 3), colors of the changed keys in key order
+ *  STREAM_RLE:   first key, spans of (count, color)
+ * Keys that are not sent keep their color from the previous frame.
+ */
+typedef enum {
+    STREAM_RAW = 0,
+    STREAM_DELTA,
+    STREAM_RLE,
+    STREAM_ENCODING_COUNT
+} StreamEncoding;
+
+#define STREAM_BITMAP_SIZE  ((NUM_KEYS + 7) / 8)
+
+// format byte: color format, encoding and the show flag
+#define STREAM_FORMAT_MASK      0x0F
+#define STREAM_ENCODING_SHIFT   4
+#define STREAM_ENCODING_MASK    0x30
+// set to show the frame after the keys are written
+#define STREAM_SHOW_FLAG        0x80
+
+void led_stream_setEnabled(bool enabled);
+bool led_stream_isEnabled(void);
+bool led_stream_writeKeys(const uint8_t* data, uint8_t length);
+void led_stream_show(void);
+
+// Render thread side
+void led_stream_update(void);
+bool led_stream_present(led_t* ledColors);
@@ -21,33 +21,27 @@ static const uint32_t colorPalette[] = {0xF0000, 0xF0F00, 0x00F00, 0x00F0F, 0x00
 // Array with Modifier keys IDs (Esc, Tab, Ctrl, Enter etc) 
 static const uint8_t modKeyIDs[] = {0, 13, 14, 28, 40, 41, 42, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69};
 
+keyMask ledDirtyKeys;
+
 /*
     Function declarations
 */
 
 // Set all keys lighting to a specific color
 void setAllKeysColor(led_t* ledColors, uint32_t color){
-    const uint8_t red = (color >> 16) & 0xFF;
-    const uint8_t green = (color >> 8) & 0xFF;
-    const uint8_t blue = color & 0xFF;
+    const led_t ledColor = { (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF };
 
     for (uint16_t i=0; i<NUM_COLUMN * NUM_ROW; ++i){
-        ledColors[i].red = red;
-        ledColors[i].green = green;
-        ledColors[i].blue = blue;
+        setLedColor(ledColors, i, &ledColor);
     }
 }
 
 // Set modifier keys lighting to a specific color
 void setModKeysColor(led_t* ledColors, uint32_t color){
-    const uint8_t red = (color >> 16) & 0xFF;
-    const uint8_t green = (color >> 8) & 0xFF;
-    const uint8_t blue = color & 0xFF;
+    const led_t ledColor = { (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF };
     
     for (uint16_t i=0; i<LEN(modKeyIDs); ++i){
-        ledColors[modKeyIDs[i]].red = red;
-        ledColors[modKeyIDs[i]].green = green;
-        ledColors[modKeyIDs[i]].blue = blue;
+        setLedColor(ledColors, modKeyIDs[i], &ledColor);
     }
 }
 
@@ -57,3 +51,34 @@ void setKeyColor(led_t *key, uint32_t color){
     key->green = (color >> 8) & 0xFF;
     key->blue = color & 0xFF;
 }
+
+// Set all keys to black
+void clearLedColors(led_t* ledColors){
+    const led_t black = {0, 0, 0};
+
+    for (uint16_t i=0; i<NUM_COLUMN * NUM_ROW; ++i){
+        setLedColor(ledColors, i, &black);
+    }
+}
+
+// Mark every key as changed, e.g. when a setting affects the whole frame
+void markAllKeysDirty(void){
+    for (uint8_t i=0; i<LEN(ledDirtyKeys.bits); ++i){
+        ledDirtyKeys.bits[i] = 0xFFFFFFFF;
+    }
+}
+
+void clearDirtyKeys(void){
+    for (uint8_t i=0; i<LEN(ledDirtyKeys.bits); ++i){
+        ledDirtyKeys.bits[i] = 0;
+    }
+}
+
+bool anyKeyDirty(void){
+    for (uint8_t i=0; i<LEN(ledDirtyKeys.bits); ++i){
+        if (ledDirtyKeys.bits[i])
+            return true;
+    }
+
+    return false;
+}
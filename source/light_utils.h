@@ -13,6 +13,45 @@ typedef struct {
 } led_t;
 
 
+/*
+    Dirty key tracking
+    Writes that go through setLedColor() mark the key as changed, in whichever
+    layer buffer they happen. Post-processing and the frame compile then only
+    touch the changed keys, and skip the frame when nothing changed.
+*/
+#define NUM_KEYS (NUM_COLUMN * NUM_ROW)
+
+typedef struct {
+    uint32_t bits[(NUM_KEYS + 31) / 32];
+} keyMask;
+
+extern keyMask ledDirtyKeys;
+
+static inline void keyMaskSet(keyMask* mask, uint8_t idx) {
+    mask->bits[idx >> 5] |= 1u << (idx & 31);
+}
+
+static inline bool keyMaskTest(const keyMask* mask, uint8_t idx) {
+    return mask->bits[idx >> 5] & (1u << (idx & 31));
+}
+
+static inline void markKeyDirty(uint8_t idx) {
+    keyMaskSet(&ledDirtyKeys, idx);
+}
+
+static inline bool keyIsDirty(uint8_t idx) {
+    return keyMaskTest(&ledDirtyKeys, idx);
+}
+
+static inline void setLedColor(led_t* ledColors, uint8_t idx, const led_t* color) {
+    led_t* led = &ledColors[idx];
+    if (led->red != color->red || led->green != color->green || led->blue != color->blue) {
+        *led = *color;
+        markKeyDirty(idx);
+    }
+}
+
+
 
 /*
     Function Signatures
@@ -20,5 +59,10 @@ typedef struct {
 void setAllKeysColor(led_t* ledColors, uint32_t color);
 void setModKeysColor(led_t* ledColors, uint32_t color);
 void setKeyColor(led_t *key, uint32_t color);
+void clearLedColors(led_t* ledColors);
+
+void markAllKeysDirty(void);
+void clearDirtyKeys(void);
+bool anyKeyDirty(void);
 
 #endif
\ No newline at end of file
@@ -2,51 +2,406 @@
 #include "led_state.h"
 #include "main_comm.h"
 #include "profiles.h"
+#include "perf_stats.h"
+#include "led_multiplexing.h"
+#include "led_stream.h"
+#include "key_events.h"
+#include "string.h"
 
 
-static void readLocked(void);
-static void readProfile(void);
-static void readBrightness(void);
-static void readPowerPlan(void);
-static void readWeather(void);
-static void readKeypress(void);
-static void readBltConnecting(void);
-static void goIntoIAP(void);
+//// Packet Parser ////
+/*
+ * Bytes are fed one at a time as they arrive, so a command never waits
+ * for the next one and a lost byte costs at most one packet.
+ *
+ * Framed packets (protocol version 1):
+ *   COMM_FRAME_START, version, opcode, length, payload[length], crc
+ * The CRC-8 covers version to the end of the payload. Responses use the
+ * same format with the request's opcode.
+ *
+ * Legacy packets: a bare opcode followed by its fixed-size payload, as
+ * sent by older main firmware. Responses are raw bytes.
+ *
+ * A gap of more than COMM_BYTE_TIMEOUT_MS inside a packet drops it.
+ */
+#define COMM_BYTE_TIMEOUT_MS    50
+
+typedef enum {
+    PARSE_IDLE = 0,
+    PARSE_LEGACY_PAYLOAD,
+    PARSE_VERSION,
+    PARSE_OPCODE,
+    PARSE_LENGTH,
+    PARSE_PAYLOAD,
+    PARSE_CRC
+} parseState;
+
+static parseState state = PARSE_IDLE;
+static bool framed = false;
+static uint8_t opcode;
+static uint8_t payloadLength;
+static uint8_t payloadReceived;
+static uint8_t payload[COMM_MAX_PAYLOAD];
+static uint8_t crc;
+static systime_t lastByteTime;
+
+static uint32_t parseErrors = 0;
+// parse errors since the last good packet
+static uint8_t errorBurst = 0;
+
+// payload size of the legacy packets, 0 for the ones without a payload
+static const uint8_t legacyPayloadLength[LED_MSG_CODE_COUNT] = {
+    [LED_SET_PROFILE]       = 1,
+    [LED_KEY_PRESSED]       = 1,
+    [LED_BLT_CONNECTING]    = 1,
+    [LED_SET_BRIGHT]        = 1,
+    [LED_SET_LOCKED]        = 1,
+    [LED_SET_POWER_PLAN]    = 1,
+    [LED_UPDATE_WEATHER]    = sizeof(WeatherData),
+    [LED_SET_SCAN_MODE]     = 1,
+    [LED_STREAM_MODE]       = 1,
+    [LED_SET_STATS_PUSH]    = 1,
+    [LED_SET_DITHERING]     = 1,
+};
+
+static void executeMsg(uint8_t code, const uint8_t* data, uint8_t length);
+static void linkError(void);
+
+
+/*
+ * Commands run with the state locked, so the render thread never sees one
+ * half applied (a profile selected but its state not initialized yet).
+ * The benchmark runs in the render thread and must not hold it off.
+ */
+static void packetReceived(void) {
+    bool locked = opcode != LED_RUN_BENCHMARK;
+
+    errorBurst = 0;
+    if (locked)
+        beginStateUpdate();
+    executeMsg(opcode, payload, payloadLength);
+    if (locked)
+        endStateUpdate();
+    state = PARSE_IDLE;
+
+    // any command may have lit something up
+    wakeRendering();
+}
+
+static void parseError(void) {
+    parseErrors++;
+    linkError();
+    state = PARSE_IDLE;
+}
+
+
+void main_comm_processByte(uint8_t byte) {
+    systime_t now = sysTimeMs();
+    if (state != PARSE_IDLE && now - lastByteTime > COMM_BYTE_TIMEOUT_MS)
+        parseError();
+    lastByteTime = now;
+
+    switch (state) {
+    case PARSE_IDLE:
+        if (byte == COMM_FRAME_START) {
+            framed = true;
+            state = PARSE_VERSION;
+        }
+        else if (byte < LED_MSG_CODE_COUNT) {
+            framed = false;
+            opcode = byte;
+            payloadLength = legacyPayloadLength[byte];
+            payloadReceived = 0;
+
+            if (payloadLength)
+                state = PARSE_LEGACY_PAYLOAD;
+            else
+                packetReceived();
+        }
+        break;
+
+    case PARSE_LEGACY_PAYLOAD:
+        payload[payloadReceived++] = byte;
+        if (payloadReceived == payloadLength)
+            packetReceived();
+        break;
 
+    case PARSE_VERSION:
+        if (byte != COMM_VERSION) {
+            parseError();
+            break;
+        }
+        crc = crc8(0, &byte, 1);
+        state = PARSE_OPCODE;
+        break;
+
+    case PARSE_OPCODE:
+        opcode = byte;
+        crc = crc8(crc, &byte, 1);
+        state = PARSE_LENGTH;
+        break;
+
+    case PARSE_LENGTH:
+        payloadLength = byte;
+        payloadReceived = 0;
+        crc = crc8(crc, &byte, 1);
+        state = payloadLength ? PARSE_PAYLOAD : PARSE_CRC;
+        break;
+
+    case PARSE_PAYLOAD:
+        payload[payloadReceived++] = byte;
+        if (payloadReceived == payloadLength) {
+            crc = crc8(crc, payload, payloadLength);
+            state = PARSE_CRC;
+        }
+        break;
+
+    case PARSE_CRC:
+        if (byte == crc)
+            packetReceived();
+        else
+            parseError();
+        break;
+
+    default:
+        state = PARSE_IDLE;
+        break;
+    }
+}
+
+uint32_t main_comm_getParseErrors(void) {
+    return parseErrors;
+}
+
+
+// opcode of the command being executed, differs from the packet's inside a batch
+static uint8_t executingCode;
+
+static bool batchActive = false;
+static uint8_t batchReply[COMM_MAX_PAYLOAD];
+static uint8_t batchReplyLength;
+
+static void writeFrame(uint8_t code, const uint8_t* data, uint8_t length) {
+    uint8_t header[4] = { COMM_FRAME_START, COMM_VERSION, code, length };
+    uint8_t frameCrc = crc8(crc8(0, &header[1], 3), data, length);
+
+    sdWrite(&SD1, header, sizeof(header));
+    sdWrite(&SD1, data, length);
+    sdWrite(&SD1, &frameCrc, 1);
+}
+
+// Answers the command being executed, in the format it arrived in.
+// Inside a batch the answer is collected for the combined reply.
+static void reply(const uint8_t* data, uint8_t length) {
+    if (batchActive) {
+        // replies that do not fit are dropped, the host sees them missing
+        if (batchReplyLength + 2 + length > COMM_MAX_PAYLOAD)
+            return;
+
+        batchReply[batchReplyLength++] = executingCode;
+        batchReply[batchReplyLength++] = length;
+        memcpy(&batchReply[batchReplyLength], data, length);
+        batchReplyLength += length;
+    }
+    else if (framed) {
+        writeFrame(executingCode, data, length);
+    }
+    else {
+        sdWrite(&SD1, data, length);
+    }
+}
 
-enum LedMsgCode {           // Messages:
-    LED_TOGGLE = 1,         // 1 byte: 0 - off, 1 - on
-    LED_NEXT_PROFILE,       // 0 byte
-    LED_PREV_PROFILE,       // 0 byte
-    LED_SET_PROFILE,        // 1 byte: profile
-    LED_GET_PROFILE,        // 0 byte;  response - 1 byte: message
-    LED_GET_PROFILE_COUNT,  // 0 byte;  response - 1 byte: message
-    LED_KEY_PRESSED,        // 1 byte: col (4 bits) + row (4 bits)
-    LED_CAPS_ON,            // 0 byte
-    LED_CAPS_OFF,           // 0 byte
-    LEP2D_BLT_CONNECTING,   // 1 byte: 1-4
-    LED_BLT_CONNECTED,      // 0 byte
-    LED_BRIGHT_DOWN,        // 0 byte
-    LED_BRIGHT_UP,          // 0 byte
-    LED_SET_BRIGHT,         // 1 byte: brightness (0-100)
-    LED_GET_BRIGHT,
-    LED_GAMING_ON,
-    LED_GAMING_OFF,
-    LED_SET_LOCKED,
-    LED_IAP_MODE,
-    LED_SET_POWER_PLAN,     // 1 byte; 0 - battery, 1 - usb, 2 - max
-    LED_UPDATE_WEATHER,
-    LED_SHOW_TEMP,
-    LED_SHOW_TIME,
-    LED_MAIN_INIT_DONE,
+//// ////
+
+
+//// Stats Push ////
+
+#define STATS_PUSH_UNIT_MS 100
+#define STATS_VERSION       2
+#define STATS_MAX_THREADS   4
+#define STATS_MAX_SIZE      (31 + STATS_MAX_THREADS * 2)
+
+static uint8_t buildStats(uint8_t* out);
+
+static uint8_t statsPushInterval = 0;
+static systime_t lastStatsPush;
+
+static void setStatsPush(uint8_t interval) {
+    statsPushInterval = interval;
+    lastStatsPush = sysTimeMs();
+}
+
+static void updateStatsPush(void) {
+    if (statsPushInterval && sysTimeMs() - lastStatsPush >= statsPushInterval * STATS_PUSH_UNIT_MS) {
+        uint8_t stats[STATS_MAX_SIZE];
+
+        lastStatsPush = sysTimeMs();
+        writeFrame(LED_GET_STATS, stats, buildStats(stats));
+    }
+}
+
+//// ////
+
+
+//// Link Speed ////
+/*
+ * The link starts at 115200 baud. LED_SET_BAUD is acknowledged at the
+ * current speed, then both ends switch and the host has
+ * LINK_CONFIRM_TIMEOUT_MS to send LED_CONFIRM_BAUD at the new speed.
+ * Without it, or after LINK_ERROR_LIMIT bad packets in a row, the link
+ * falls back to 115200.
+ */
+typedef enum {
+    LINK_115200 = 0,
+    LINK_460800,
+    LINK_921600,
+    LINK_1000000,
+    LINK_SPEED_COUNT
+} LinkSpeed;
+
+#define LINK_CONFIRM_TIMEOUT_MS 500
+#define LINK_ERROR_LIMIT        8
+#define LINK_POLL_MS            10
+
+#define UART_ERROR_FLAGS (SD_PARITY_ERROR | SD_FRAMING_ERROR | SD_OVERRUN_ERROR | SD_NOISE_ERROR)
+// a byte lost in the UART or because the input queue was full
+#define RX_OVERFLOW_FLAGS (SD_OVERRUN_ERROR | SD_QUEUE_FULL_ERROR)
+
+static const uint32_t linkBaudRates[LINK_SPEED_COUNT] = {
+    [LINK_115200] = 115200,
+    [LINK_460800] = 460800,
+    [LINK_921600] = 921600,
+    [LINK_1000000] = 1000000,
+};
+
+static SerialConfig usart1Config = {
+    .speed = 115200
 };
 
+static LinkSpeed linkSpeed = LINK_115200;
+static bool linkConfirmPending = false;
+static bool linkFallbackPending = false;
+static systime_t linkSwitchTime;
+static LinkSpeed linkSwitchPending = LINK_115200;
+static bool linkSwitchRequested = false;
+
+static event_listener_t serialListener;
+static uint8_t linkFallbacks = 0;
+// errors measured since the last speed change
+static uint16_t linkParseErrors = 0;
+static uint16_t linkUartErrors = 0;
+static uint32_t rxOverflows = 0;
+
+
+void main_comm_init(void) {
+    sdStart(&SD1, &usart1Config);
+    chEvtRegisterMaskWithFlags(chnGetEventSource(&SD1), &serialListener,
+                               EVENT_MASK(0), UART_ERROR_FLAGS | RX_OVERFLOW_FLAGS);
+}
+
+static void setLinkSpeed(LinkSpeed speed) {
+    // let the acknowledge leave at the old speed first
+    chSysLock();
+    while (!oqIsEmptyI(&SD1.oqueue)) {
+        chSysUnlock();
+        chThdSleepMilliseconds(1);
+        chSysLock();
+    }
+    chSysUnlock();
+    chThdSleepMilliseconds(1);
+
+    usart1Config.speed = linkBaudRates[speed];
+    sdStop(&SD1);
+    sdStart(&SD1, &usart1Config);
+
+    linkSpeed = speed;
+    linkParseErrors = 0;
+    linkUartErrors = 0;
+    errorBurst = 0;
+    state = PARSE_IDLE;
+    chEvtGetAndClearFlags(&serialListener);
+}
+
+static void linkError(void) {
+    if (linkParseErrors < UINT16_MAX)
+        linkParseErrors++;
+
+    if (linkSpeed != LINK_115200 && ++errorBurst >= LINK_ERROR_LIMIT)
+        linkFallbackPending = true;
+}
+
+static void writeLinkStats(void) {
+    uint8_t response[6] = {
+        linkSpeed,
+        linkFallbacks,
+        linkParseErrors & 0xFF,
+        linkParseErrors >> 8,
+        linkUartErrors & 0xFF,
+        linkUartErrors >> 8
+    };
+
+    reply(response, sizeof(response));
+}
+
+// Receive timeout for the serial thread, the link and the stats push need polling.
+sysinterval_t main_comm_getPollTimeout(void) {
+    if (linkConfirmPending)
+        return TIME_MS2I(LINK_POLL_MS);
+    if (statsPushInterval)
+        return TIME_MS2I(STATS_PUSH_UNIT_MS);
+    return TIME_INFINITE;
+}
+
+// Called by the serial thread after every byte or receive timeout.
+void main_comm_update(void) {
+    eventflags_t flags = chEvtGetAndClearFlags(&serialListener);
+    if ((flags & UART_ERROR_FLAGS) && linkUartErrors < UINT16_MAX)
+        linkUartErrors++;
+    if (flags & RX_OVERFLOW_FLAGS)
+        rxOverflows++;
+
+    if (linkSwitchRequested) {
+        linkSwitchRequested = false;
+        setLinkSpeed(linkSwitchPending);
+        linkConfirmPending = linkSpeed != LINK_115200;
+        linkSwitchTime = sysTimeMs();
+    }
+
+    if (linkConfirmPending && sysTimeMs() - linkSwitchTime > LINK_CONFIRM_TIMEOUT_MS)
+        linkFallbackPending = true;
+
+    if (linkFallbackPending) {
+        linkFallbackPending = false;
+        linkConfirmPending = false;
+        linkFallbacks++;
+        setLinkSpeed(LINK_115200);
+    }
+
+    updateStatsPush();
+}
+
+//// ////
+
+
+static void goIntoIAP(void);
+static void writeScanStats(void);
+static void writeKeyLatency(void);
+static uint8_t buildStats(uint8_t* out);
+static void executeBatch(const uint8_t* data, uint8_t length);
+static void writeBenchmark(uint16_t iterations);
+
 
 /*
  * Execute action based on a message
+ * Commands with a payload ignore packets that are too short.
  */
-void main_comm_executeMsg(msg_t msg){
-    switch (msg) {
+static void executeMsg(uint8_t code, const uint8_t* data, uint8_t length) {
+    if (code < LED_MSG_CODE_COUNT && length < legacyPayloadLength[code])
+        return;
+
+    executingCode = code;
+
+    switch (code) {
         case LED_TOGGLE:
             toggleLeds();
             break;
@@ -60,23 +415,23 @@ void main_comm_executeMsg(msg_t msg){
             break;
 
         case LED_SET_PROFILE:
-            readProfile();
+            switchProfile(data[0]);
             break;
 
         case LED_GET_PROFILE: {
             uint8_t currentProfile = getCurrentProfileIndex();
-            sdWrite(&SD1, &currentProfile, 1);
+            reply(&currentProfile, 1);
         }
             break;
-            
+
         case LED_GET_PROFILE_COUNT: {
             uint8_t profileCount = getProfileCount();
-            sdWrite(&SD1, &profileCount, 1);
+            reply(&profileCount, 1);
         }
             break;
 
         case LED_KEY_PRESSED:
-            readKeypress();
+            keyPressedCallback(data[0]);
             break;
 
         case LED_CAPS_ON:
@@ -88,7 +443,7 @@ void main_comm_executeMsg(msg_t msg){
             break;
 
         case LED_BLT_CONNECTING:
-            readBltConnecting();
+            bltConnecting(data[0]);
             break;
 
         case LED_BLT_CONNECTED:
@@ -104,11 +459,13 @@ void main_comm_executeMsg(msg_t msg){
             break;
 
         case LED_SET_BRIGHT:
-            readBrightness();
+            setBrightness(data[0]);
             break;
 
-        case LED_GET_BRIGHT:
-            sdPut(&SD1, (uint8_t)(getBrightness()));
+        case LED_GET_BRIGHT: {
+            uint8_t brightness = getBrightness();
+            reply(&brightness, 1);
+        }
             break;
 
         case LED_GAMING_ON:
@@ -120,7 +477,8 @@ void main_comm_executeMsg(msg_t msg){
             break;
 
         case LED_SET_LOCKED:
-            readLocked();
+            setLocked(data[0]);
+            executeInit();
             break;
 
         case LED_IAP_MODE:
@@ -128,11 +486,15 @@ void main_comm_executeMsg(msg_t msg){
             break;
 
         case LED_SET_POWER_PLAN:
-            readPowerPlan();
+            setPowerPlan((PowerPlan)data[0]);
             break;
 
         case LED_UPDATE_WEATHER:
-            readWeather();
+            setWeatherData((WeatherData*) data);
+
+            if (getCurrentProfile() == &prof_liveWeather) {
+                reconfigureProfile();
+            }
             break;
 
         case LED_SHOW_TEMP:
@@ -145,14 +507,94 @@ void main_comm_executeMsg(msg_t msg){
 
         case LED_MAIN_INIT_DONE:
             mainInitDoneCallback();
+            break;
+
+        case LED_GET_SCAN_STATS:
+            writeScanStats();
+            break;
+
+        case LED_SET_SCAN_MODE:
+            led_multiplexing_setScanMode((ScanMode)data[0]);
+            break;
+
+        case LED_STREAM_MODE:
+            led_stream_setEnabled(data[0]);
+            break;
+
+        case LED_STREAM_KEYS:
+            led_stream_writeKeys(data, length);
+            break;
+
+        case LED_STREAM_SHOW:
+            led_stream_show();
+            break;
+
+        // a stray legacy byte must never change the speed
+        case LED_SET_BAUD: {
+            uint8_t accepted = framed && length >= 1 && data[0] < LINK_SPEED_COUNT;
+            reply(&accepted, 1);
+
+            if (accepted) {
+                linkSwitchPending = (LinkSpeed)data[0];
+                linkSwitchRequested = true;
+            }
+        }
+            break;
+
+        case LED_CONFIRM_BAUD:
+            if (framed) {
+                linkConfirmPending = false;
+                writeLinkStats();
+            }
+            break;
+
+        case LED_GET_LINK_STATS:
+            writeLinkStats();
+            break;
+
+        case LED_KEY_EVENT:
+            for (; length >= 4; length -= 4, data += 4)
+                keyEventCallback(data[0], data[1], data[2] | (data[3] << 8));
+            break;
+
+        case LED_KEY_MATRIX:
+            if (length >= 2 + KEY_MATRIX_SIZE)
+                keyMatrixCallback(&data[2], data[0] | (data[1] << 8));
+            break;
+
+        case LED_GET_KEY_LATENCY:
+            writeKeyLatency();
+            break;
+
+        case LED_GET_STATS: {
+            uint8_t stats[STATS_MAX_SIZE];
+            reply(stats, buildStats(stats));
+        }
+            break;
+
+        case LED_SET_STATS_PUSH:
+            setStatsPush(data[0]);
+            break;
+
+        case LED_BATCH:
+            if (framed && !batchActive)
+                executeBatch(data, length);
+            break;
+
+        case LED_RUN_BENCHMARK:
+            if (framed && length >= 2)
+                writeBenchmark(data[0] | (data[1] << 8));
+            break;
+
+        case LED_SET_DITHERING:
+            led_multiplexing_setDithering(data[0]);
+            break;
 
         default:
             break;
     }
 }
 
-static uint8_t commandBuffer[64];
-
 
 static void goIntoIAP() {
     *((uint32_t*)0x20001ffc) = 0x0000fab2;
@@ -161,76 +603,157 @@ static void goIntoIAP() {
 }
 
 
-static void readProfile(){
-    size_t bytesRead;
-    bytesRead = sdReadTimeout(&SD1, commandBuffer, 1, 10000);
-
-    if(bytesRead == 1) {
-        switchProfile(commandBuffer[0]);
+/*
+ * Runs every command of the batch between two frames (the state is
+ * locked by packetReceived) and answers with one combined reply. A malformed batch runs nothing and gets an empty
+ * reply. Commands that reset or reconfigure the link are skipped, and so
+ * is the benchmark, it needs the render thread the batch holds off.
+ */
+static void executeBatch(const uint8_t* data, uint8_t length) {
+    uint8_t offset = 0;
+    while (offset < length) {
+        if (length - offset < 2 || data[offset + 1] > length - offset - 2) {
+            parseErrors++;
+            length = 0;
+            break;
+        }
+        offset += 2 + data[offset + 1];
     }
-}
 
+    batchActive = true;
+    batchReplyLength = 0;
 
-static void readBltConnecting() {
-    size_t bytesRead;
-    bytesRead = sdReadTimeout(&SD1, commandBuffer, 1, 10000);
+    for (offset = 0; offset < length; offset += 2 + data[offset + 1]) {
+        uint8_t code = data[offset];
 
-    if(bytesRead == 1){
-        bltConnecting(commandBuffer[0]);
+        if (code != LED_BATCH && code != LED_IAP_MODE && code != LED_SET_BAUD && code != LED_RUN_BENCHMARK)
+            executeMsg(code, &data[offset + 2], data[offset + 1]);
     }
-}
-
 
-static void readKeypress() {
-    size_t bytesRead;
-    bytesRead = sdReadTimeout(&SD1, commandBuffer, 1, 10000);
+    batchActive = false;
 
-    if(bytesRead == 1) {
-        uint8_t keyPos = commandBuffer[0];
-        keyPressedCallback(keyPos);
-    }
+    executingCode = LED_BATCH;
+    reply(batchReply, batchReplyLength);
 }
 
 
-static void readBrightness() {
-    size_t bytesRead;
-    bytesRead = sdReadTimeout(&SD1, commandBuffer, 1, 10000);
+static void writeScanStats(void) {
+    uint16_t refreshRate = perf_getRefreshRate();
+    uint8_t response[3] = {
+        refreshRate & 0xFF,
+        refreshRate >> 8,
+        perf_getIdlePercent()
+    };
 
-    if(bytesRead == 1) {
-        setBrightness(commandBuffer[0]);
-    }
+    reply(response, sizeof(response));
 }
 
-static void readPowerPlan() {
-    size_t bytesRead;
-    bytesRead = sdReadTimeout(&SD1, commandBuffer, 1, 10000);
 
-    if(bytesRead == 1) {
-        setPowerPlan((PowerPlan)commandBuffer[0]);
+static void writeKeyLatency(void) {
+    uint16_t histogram[PERF_LATENCY_BUCKETS];
+    uint32_t maxCycles;
+    uint8_t response[PERF_LATENCY_BUCKETS * 2 + 4];
+
+    perf_getKeyLatency(histogram, &maxCycles);
+    uint32_t maxUs = perf_cyclesToUs(maxCycles);
+
+    for (uint8_t i = 0; i < PERF_LATENCY_BUCKETS; i++) {
+        response[i * 2] = histogram[i] & 0xFF;
+        response[i * 2 + 1] = histogram[i] >> 8;
     }
+    for (uint8_t i = 0; i < 4; i++)
+        response[PERF_LATENCY_BUCKETS * 2 + i] = maxUs >> (i * 8);
+
+    reply(response, sizeof(response));
 }
 
 
-static void readLocked() {
-    size_t bytesRead;
-    bytesRead = sdReadTimeout(&SD1, commandBuffer, 1, 10000);
+static uint8_t* putU16(uint8_t* out, uint32_t value) {
+    if (value > UINT16_MAX)
+        value = UINT16_MAX;
 
-    if(bytesRead == 1) {
-        setLocked(commandBuffer[0]);
-        executeInit();
-    }
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+    return out + 2;
 }
 
+/*
+ * Stats, little endian, counters saturate at 0xFFFF:
+ *   version (STATS_VERSION), cpu idle %, scan refresh rate,
+ *   render time min / avg / max in us, render overruns, dropped frames,
+ *   scan overruns, uart rx overflows, parse errors, dropped key events,
+ *   time asleep in s, times asleep, wake to first frame last / max in us,
+ *   thread count, free stack bytes per thread (main, idle, render)
+ */
+static uint8_t buildStats(uint8_t* out) {
+    uint8_t* p = out;
+    uint32_t renderMin, renderAvg, renderMax;
+    uint32_t wakeLast, wakeMax;
+    uint16_t stackFree[STATS_MAX_THREADS];
+
+    perf_getRenderTime(&renderMin, &renderAvg, &renderMax);
+    perf_getWakeLatency(&wakeLast, &wakeMax);
+    uint8_t threads = perf_getStackFree(stackFree, STATS_MAX_THREADS);
+
+    *p++ = STATS_VERSION;
+    *p++ = perf_getIdlePercent();
+    p = putU16(p, perf_getRefreshRate());
+    p = putU16(p, perf_cyclesToUs(renderMin));
+    p = putU16(p, perf_cyclesToUs(renderAvg));
+    p = putU16(p, perf_cyclesToUs(renderMax));
+    p = putU16(p, perf_getRenderOverruns());
+    p = putU16(p, perf_getDroppedFrames());
+    p = putU16(p, perf_getScanOverruns());
+    p = putU16(p, rxOverflows);
+    p = putU16(p, parseErrors);
+    p = putU16(p, key_events_getOverflows());
+    p = putU16(p, perf_getSleepMs() / 1000);
+    p = putU16(p, perf_getSleepCount());
+    p = putU16(p, perf_cyclesToUs(wakeLast));
+    p = putU16(p, perf_cyclesToUs(wakeMax));
+
+    *p++ = threads;
+    for (uint8_t i = 0; i < threads; i++)
+        p = putU16(p, stackFree[i]);
+
+    return p - out;
+}
 
-static void readWeather(void) {
-    sdReadTimeout(&SD1, commandBuffer, sizeof(commandBuffer), 5000);
-
-    setWeatherData((WeatherData*) commandBuffer);
 
-    Profile* currProfile = getCurrentProfile();
-    if (currProfile->tick == prof_liveWeather_tick) {
-        executeInit();
-    }
+static uint8_t* putU32(uint8_t* out, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++)
+        out[i] = value >> (i * 8);
+    return out + 4;
 }
 
+/*
+ * Benchmark, little endian:
+ *   iterations, result count,
+ *   per result: BenchTarget, index, min / avg / max cycles per call (uint32)
+ * Rendering and the scan pause while it runs.
+ */
+static void writeBenchmark(uint16_t iterations) {
+    // too big for the serial thread's stack
+    static uint8_t response[3 + BENCH_RESULT_COUNT * 14];
+    const benchResult* results;
+    uint8_t* p = response;
+
+    if (iterations == 0)
+        iterations = 1;
+    if (iterations > BENCH_MAX_ITERATIONS)
+        iterations = BENCH_MAX_ITERATIONS;
+
+    uint8_t count = runBenchmark(iterations, &results);
+
+    p = putU16(p, iterations);
+    *p++ = count;
+    for (uint8_t i = 0; i < count; i++) {
+        *p++ = results[i].target;
+        *p++ = results[i].index;
+        p = putU32(p, results[i].minCycles);
+        p = putU32(p, results[i].avgCycles);
+        p = putU32(p, results[i].maxCycles);
+    }
 
+    reply(response, p - response);
+}
@@ -2,5 +2,61 @@
 
 #include "ch.h"
 
-void main_comm_executeMsg(msg_t msg);
 
+// framed packets, see the packet parser in main_comm.c
+#define COMM_FRAME_START        0xA5
+#define COMM_VERSION            1
+#define COMM_MAX_PAYLOAD        255
+
+enum LedMsgCode {           // Messages:
+    LED_TOGGLE = 1,         // 0 byte
+    LED_NEXT_PROFILE,       // 0 byte
+    LED_PREV_PROFILE,       // 0 byte
+    LED_SET_PROFILE,        // 1 byte: profile
+    LED_GET_PROFILE,        // 0 byte;  response - 1 byte: message
+    LED_GET_PROFILE_COUNT,  // 0 byte;  response - 1 byte: message
+    LED_KEY_PRESSED,        // 1 byte: col (4 bits) + row (4 bits)
+    LED_CAPS_ON,            // 0 byte
+    LED_CAPS_OFF,           // 0 byte
+    LED_BLT_CONNECTING,     // 1 byte: 1-4
+    LED_BLT_CONNECTED,      // 0 byte
+    LED_BRIGHT_DOWN,        // 0 byte
+    LED_BRIGHT_UP,          // 0 byte
+    LED_SET_BRIGHT,         // 1 byte: brightness (0-100)
+    LED_GET_BRIGHT,         // 0 byte;  response - 1 byte: brightness
+    LED_GAMING_ON,          // 0 byte
+    LED_GAMING_OFF,         // 0 byte
+    LED_SET_LOCKED,         // 1 byte: 0 - unlocked, 1 - locked
+    LED_IAP_MODE,           // 0 byte
+    LED_SET_POWER_PLAN,     // 1 byte; 0 - battery, 1 - usb, 2 - max
+    LED_UPDATE_WEATHER,     // sizeof(WeatherData) bytes
+    LED_SHOW_TEMP,          // 0 byte
+    LED_SHOW_TIME,          // 0 byte
+    LED_MAIN_INIT_DONE,     // 0 byte
+    LED_GET_SCAN_STATS,     // 0 byte;  response - 3 bytes: refresh rate (uint16 LE), cpu idle %
+    LED_SET_SCAN_MODE,      // 1 byte: 0 - sPWM, 1 - BCM
+    LED_STREAM_MODE,        // 1 byte: 0 - off, 1 - host streams the frames
+    LED_STREAM_KEYS,        // framed only; format byte (led_stream.h), encoded keys
+    LED_STREAM_SHOW,        // 0 byte; shows the keys written so far as one frame
+    LED_SET_BAUD,           // framed only; 1 byte: LinkSpeed;  response - 1 byte: 1 - switching, 0 - rejected
+    LED_CONFIRM_BAUD,       // framed only; 0 byte, sent at the new speed;  response - link stats
+    LED_GET_LINK_STATS,     // 0 byte;  response - 6 bytes: LinkSpeed, fallbacks, parse errors, uart errors (uint16 LE)
+    LED_BATCH,              // framed only; commands as (opcode, length, payload);  response - replies as (opcode, length, payload)
+    LED_KEY_EVENT,          // framed only; 4 bytes per event: col (4 bits) + row (4 bits), 1 - pressed / 0 - released, ms timestamp (uint16 LE)
+    LED_KEY_MATRIX,         // framed only; ms timestamp (uint16 LE), bitmap of the pressed keys (KEY_MATRIX_SIZE bytes)
+    LED_GET_KEY_LATENCY,    // 0 byte;  response - 20 bytes: PERF_LATENCY_BUCKETS counts (uint16 LE), max us (uint32 LE)
+    LED_GET_STATS,          // 0 byte;  response - stats, see writeStats
+    LED_SET_STATS_PUSH,     // 1 byte: push interval in 100 ms, 0 - off; pushed as framed LED_GET_STATS replies
+    LED_RUN_BENCHMARK,      // framed only; iterations (uint16 LE), at most 1000;  response - cycle counts, see writeBenchmark
+    LED_SET_DITHERING,      // 1 byte: 0 - off, 1 - temporal dithering of the BCM output levels
+    LED_MSG_CODE_COUNT
+};
+
+// Starts the serial port to the main MCU at 115200 baud.
+void main_comm_init(void);
+sysinterval_t main_comm_getPollTimeout(void);
+void main_comm_update(void);
+
+// Feeds one received byte to the packet parser, runs complete commands.
+void main_comm_processByte(uint8_t byte);
+uint32_t main_comm_getParseErrors(void);
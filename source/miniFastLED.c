@@ -28,7 +28,7 @@ void hsv2rgb(uint8_t hue, uint8_t sat, uint8_t val, uint8_t* rgbResults){
     // The brightness floor is minimum number that all of
     // R, G, and B will be set to.
     uint8_t invsat = APPLY_DIMMING( 255 - saturation);
-    uint8_t brightness_floor = (value * invsat) / 256;
+    uint8_t brightness_floor = (value * invsat) >> 8;
 
     // The color amplitude is the maximum amount of R, G, and B
     // that will be added on top of the brightness_floor to
@@ -37,8 +37,8 @@ void hsv2rgb(uint8_t hue, uint8_t sat, uint8_t val, uint8_t* rgbResults){
 
     // Figure out which section of the hue wheel we're in,
     // and how far offset we are withing that section
-    uint8_t section = hue / HSV_SECTION_3; // 0..2
-    uint8_t offset = hue % HSV_SECTION_3;  // 0..63
+    uint8_t section = hue >> 6;                 // 0..2, hue / HSV_SECTION_3
+    uint8_t offset = hue & (HSV_SECTION_3 - 1); // 0..63, hue % HSV_SECTION_3
 
     uint8_t rampup = offset; // 0..63
     uint8_t rampdown = (HSV_SECTION_3 - 1) - offset; // 63..0
@@ -73,8 +73,10 @@ void hsv2rgb(uint8_t hue, uint8_t sat, uint8_t val, uint8_t* rgbResults){
     //  //rampdown *= 4; // 0..252
 
     // compute color-amplitude-scaled-down versions of rampup and rampdown
-    uint8_t rampup_amp_adj   = (rampup   * color_amplitude) / (256 / 4);
-    uint8_t rampdown_amp_adj = (rampdown * color_amplitude) / (256 / 4);
+    // The operands are promoted to signed int, so '/ 64' would get an extra
+    // sign fix-up; shift explicitly.
+    uint8_t rampup_amp_adj   = (rampup   * color_amplitude) >> 6;
+    uint8_t rampdown_amp_adj = (rampdown * color_amplitude) >> 6;
 
     // add brightness_floor offset to everything
     uint8_t rampup_adj_with_floor   = rampup_amp_adj   + brightness_floor;
@@ -109,10 +111,9 @@ void setAllKeysColorHSV(led_t* ledColors, uint8_t hue, uint8_t sat, uint8_t val)
     hsv2rgb(hue, sat, val, rgbArray);
 
     // Set key colors
+    const led_t color = { rgbArray[0], rgbArray[1], rgbArray[2] };
     for (uint16_t i=0; i<NUM_COLUMN * NUM_ROW; ++i){
-        ledColors[i].red = rgbArray[0];
-        ledColors[i].green = rgbArray[1];
-        ledColors[i].blue = rgbArray[2];
+        setLedColor(ledColors, i, &color);
     }
 
 }
@@ -124,11 +125,9 @@ void setColumnColorHSV(led_t* ledColors, uint8_t column, uint8_t hue, uint8_t sa
     hsv2rgb(hue, sat, val, rgbArray);
 
     // Set column key color
+    const led_t color = { rgbArray[0], rgbArray[1], rgbArray[2] };
     for (uint16_t i=0; i< NUM_ROW; ++i){
-        // section 1: 0x40..0x7F
-        ledColors[i * NUM_COLUMN + column].red = rgbArray[0];
-        ledColors[i * NUM_COLUMN + column].green = rgbArray[1];
-        ledColors[i * NUM_COLUMN + column].blue = rgbArray[2];
+        setLedColor(ledColors, i * NUM_COLUMN + column, &color);
     }
 
 }
@@ -140,11 +139,9 @@ void setRowColorHSV(led_t* ledColors, uint8_t row, uint8_t hue, uint8_t sat, uin
     hsv2rgb(hue, sat, val, rgbArray);
 
     // Set column key color
+    const led_t color = { rgbArray[0], rgbArray[1], rgbArray[2] };
     for (uint16_t i=0; i< NUM_COLUMN; ++i){
-        // section 1: 0x40..0x7F
-        ledColors[row * NUM_COLUMN + i].red = rgbArray[0];
-        ledColors[row * NUM_COLUMN + i].green = rgbArray[1];
-        ledColors[row * NUM_COLUMN + i].blue = rgbArray[2];
+        setLedColor(ledColors, row * NUM_COLUMN + i, &color);
     }
 
 }
@@ -0,0 +1,325 @@
+#include "perf_stats.h"
+#include "hal.h"
+
+
+#define PERF_WINDOW_MS          1000
+#define CYCLES_PER_SYSTICK      (SysTick->LOAD + 1)
+
+
+//// State ////
+
+static virtual_timer_t perfWindowTimer;
+static uint32_t windowStartCycles;
+
+static volatile uint32_t idleCycles = 0;
+static volatile uint16_t scanRefreshCount = 0;
+static uint32_t sweepCycles = 0;
+static uint32_t lastSweepStart = 0;
+static volatile uint32_t scanOverruns = 0;
+
+static uint32_t renderCyclesMin = UINT32_MAX;
+static uint32_t renderCyclesMax = 0;
+static uint32_t renderCyclesSum = 0;
+static uint16_t renderCount = 0;
+
+static volatile uint32_t renderOverruns = 0;
+static volatile uint32_t droppedFrames = 0;
+
+// both volatile, so the start time is stored before the flag publishes it
+static volatile bool keyEventPending = false;
+static volatile uint32_t keyEventCycles;
+static uint16_t keyLatencyHistogram[PERF_LATENCY_BUCKETS];
+static uint32_t keyLatencyMax = 0;
+
+static bool asleep = false;
+static systime_t sleepStart;
+static uint32_t sleepMs = 0;
+static uint32_t sleepCount = 0;
+// both volatile, like the key event
+static volatile bool wakePending = false;
+static volatile uint32_t wakeCycles;
+static uint32_t wakeLatencyLast = 0;
+static uint32_t wakeLatencyMax = 0;
+
+static uint16_t refreshRate = 0;
+static uint8_t idlePercent = 0;
+static uint32_t lastRenderMin = 0;
+static uint32_t lastRenderAvg = 0;
+static uint32_t lastRenderMax = 0;
+
+//// ////
+
+
+uint32_t perf_cycleCount() {
+    systime_t ticks;
+    uint32_t val;
+
+    // Retry if the tick interrupt was serviced between the two reads.
+    do {
+        ticks = chVTGetSystemTimeX();
+        val = SysTick->VAL;
+    } while (ticks != chVTGetSystemTimeX());
+
+    // With interrupts masked a SysTick wrap only leaves the interrupt pending.
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        val = SysTick->VAL;
+        ticks++;
+    }
+
+    return ticks * CYCLES_PER_SYSTICK + (SysTick->LOAD - val);
+}
+
+
+/*
+ * Called from the idle thread loop (see CH_CFG_IDLE_LOOP_HOOK).
+ * Interrupts are masked around WFI so the wake-up ISR runs only after the
+ * sleep time has been recorded; the time spent in ISRs is therefore busy time.
+ */
+void perf_idleLoopHook() {
+    __disable_irq();
+    uint32_t sleepStart = SysTick->VAL;
+    __WFI();
+    uint32_t sleepEnd = SysTick->VAL;
+
+    // WFI returns at the latest on the next SysTick, so at most one wrap happened.
+    if (sleepEnd <= sleepStart)
+        idleCycles += sleepStart - sleepEnd;
+    else
+        idleCycles += sleepStart + CYCLES_PER_SYSTICK - sleepEnd;
+    __enable_irq();
+}
+
+
+uint32_t perf_usToCycles(uint32_t us) {
+    // one system tick is 100 us
+    return us * CYCLES_PER_SYSTICK / (1000000 / CH_CFG_ST_FREQUENCY);
+}
+
+
+uint32_t perf_cyclesToUs(uint32_t cycles) {
+    return cycles / (CYCLES_PER_SYSTICK / (1000000 / CH_CFG_ST_FREQUENCY));
+}
+
+
+void perf_setScanSweepTime(uint32_t us) {
+    chSysLock();
+    sweepCycles = perf_usToCycles(us);
+    lastSweepStart = 0;
+    chSysUnlock();
+}
+
+// Called by the scan ISR at the start of every sweep.
+void perf_countScanRefresh() {
+    uint32_t now = perf_cycleCount();
+
+    if (lastSweepStart && now - lastSweepStart > sweepCycles + (sweepCycles >> 1))
+        scanOverruns++;
+
+    lastSweepStart = now;
+    scanRefreshCount++;
+}
+
+void perf_recordRenderTime(uint32_t cycles) {
+    chSysLock();
+    if (cycles < renderCyclesMin)
+        renderCyclesMin = cycles;
+    if (cycles > renderCyclesMax)
+        renderCyclesMax = cycles;
+    renderCyclesSum += cycles;
+    renderCount++;
+    chSysUnlock();
+}
+
+void perf_countRenderOverrun() {
+    renderOverruns++;
+}
+
+void perf_countDroppedFrame() {
+    droppedFrames++;
+}
+
+
+// Serial thread: starts a measurement unless one is running.
+void perf_keyEventReceived() {
+    if (keyEventPending)
+        return;
+
+    keyEventCycles = perf_cycleCount();
+    keyEventPending = true;
+}
+
+// Render thread: takes the running measurement to tag the next frame with.
+bool perf_takeKeyEvent(uint32_t* startCycles) {
+    if (!keyEventPending)
+        return false;
+
+    *startCycles = keyEventCycles;
+    keyEventPending = false;
+    return true;
+}
+
+// Scan ISR: the tagged frame is being shown.
+void perf_recordKeyLatency(uint32_t cycles) {
+    uint32_t msCycles = CYCLES_PER_SYSTICK * (CH_CFG_ST_FREQUENCY / 1000);
+    uint8_t bucket = 0;
+
+    while (bucket < PERF_LATENCY_BUCKETS - 1 && cycles >= msCycles << bucket)
+        bucket++;
+
+    if (keyLatencyHistogram[bucket] < UINT16_MAX)
+        keyLatencyHistogram[bucket]++;
+    if (cycles > keyLatencyMax)
+        keyLatencyMax = cycles;
+}
+
+
+// Render thread: the timers are stopped.
+void perf_sleepEntered() {
+    chSysLock();
+    sleepStart = chVTGetSystemTimeX();
+    asleep = true;
+    sleepCount++;
+    chSysUnlock();
+}
+
+// Render thread: the timers run again.
+void perf_sleepLeft() {
+    chSysLock();
+    sleepMs += TIME_I2MS(chVTGetSystemTimeX() - sleepStart);
+    asleep = false;
+    chSysUnlock();
+}
+
+// Serial thread: a command is about to wake the render thread.
+void perf_wakeRequested() {
+    if (wakePending)
+        return;
+
+    wakeCycles = perf_cycleCount();
+    wakePending = true;
+}
+
+// Render thread: the first frame after waking up is compiled.
+void perf_wakeFrameDone() {
+    if (!wakePending)
+        return;
+
+    wakeLatencyLast = perf_cycleCount() - wakeCycles;
+    if (wakeLatencyLast > wakeLatencyMax)
+        wakeLatencyMax = wakeLatencyLast;
+    wakePending = false;
+}
+
+
+static void perfWindowCallback(void* arg) {
+    (void)arg;
+
+    uint32_t now = perf_cycleCount();
+    uint32_t windowCycles = now - windowStartCycles;
+    windowStartCycles = now;
+
+    refreshRate = (uint32_t)scanRefreshCount * 1000 / PERF_WINDOW_MS;
+    idlePercent = idleCycles / (windowCycles / 100);
+    if (idlePercent > 100)
+        idlePercent = 100;
+
+    lastRenderMin = renderCount ? renderCyclesMin : 0;
+    lastRenderMax = renderCyclesMax;
+    lastRenderAvg = renderCount ? renderCyclesSum / renderCount : 0;
+
+    scanRefreshCount = 0;
+    idleCycles = 0;
+    renderCyclesMin = UINT32_MAX;
+    renderCyclesMax = 0;
+    renderCyclesSum = 0;
+    renderCount = 0;
+
+    chSysLockFromISR();
+    chVTSetI(&perfWindowTimer, TIME_MS2I(PERF_WINDOW_MS), perfWindowCallback, NULL);
+    chSysUnlockFromISR();
+}
+
+
+void perf_init() {
+    windowStartCycles = perf_cycleCount();
+    chVTSet(&perfWindowTimer, TIME_MS2I(PERF_WINDOW_MS), perfWindowCallback, NULL);
+}
+
+
+uint16_t perf_getRefreshRate() {
+    return refreshRate;
+}
+
+uint8_t perf_getIdlePercent() {
+    return idlePercent;
+}
+
+void perf_getRenderTime(uint32_t* minCycles, uint32_t* avgCycles, uint32_t* maxCycles) {
+    *minCycles = lastRenderMin;
+    *avgCycles = lastRenderAvg;
+    *maxCycles = lastRenderMax;
+}
+
+uint32_t perf_getRenderOverruns() {
+    return renderOverruns;
+}
+
+uint32_t perf_getDroppedFrames() {
+    return droppedFrames;
+}
+
+uint32_t perf_getScanOverruns() {
+    return scanOverruns;
+}
+
+
+/*
+ * Working areas are filled with CH_DBG_STACK_FILL_VALUE when a thread is
+ * created (the main stack by the startup code), the stack grows down
+ * towards wabase, so the untouched bytes there were never used.
+ */
+uint8_t perf_getStackFree(uint16_t* freeBytes, uint8_t maxThreads) {
+    uint8_t count = 0;
+
+    for (thread_t* tp = chRegFirstThread(); tp; tp = chRegNextThread(tp)) {
+        if (count == maxThreads)
+            continue;
+
+        const uint8_t* p = (const uint8_t*)tp->wabase;
+        while (*p == CH_DBG_STACK_FILL_VALUE)
+            p++;
+
+        freeBytes[count++] = p - (const uint8_t*)tp->wabase;
+    }
+
+    return count;
+}
+
+void perf_getKeyLatency(uint16_t* histogram, uint32_t* maxCycles) {
+    chSysLock();
+    for (uint8_t i = 0; i < PERF_LATENCY_BUCKETS; i++)
+        histogram[i] = keyLatencyHistogram[i];
+    *maxCycles = keyLatencyMax;
+    chSysUnlock();
+}
+
+uint32_t perf_getSleepMs() {
+    chSysLock();
+    uint32_t ms = sleepMs;
+    if (asleep)
+        ms += TIME_I2MS(chVTGetSystemTimeX() - sleepStart);
+    chSysUnlock();
+
+    return ms;
+}
+
+uint32_t perf_getSleepCount() {
+    return sleepCount;
+}
+
+void perf_getWakeLatency(uint32_t* lastCycles, uint32_t* maxCycles) {
+    chSysLock();
+    *lastCycles = wakeLatencyLast;
+    *maxCycles = wakeLatencyMax;
+    chSysUnlock();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "ch.h"
+
+
+/*
+ * Cycle counter built on top of SysTick.
+ * The M0+ has no DWT, but SysTick runs from HCLK and wraps every
+ * system tick, so system ticks + the current SysTick value gives
+ * a cheap 32-bit cycle timestamp (wraps every ~89 s at 48 MHz).
+ */
+uint32_t perf_cycleCount(void);
+uint32_t perf_usToCycles(uint32_t us);
+uint32_t perf_cyclesToUs(uint32_t cycles);
+
+void perf_init(void);
+void perf_idleLoopHook(void);
+
+// expected time of one scan sweep, a sweep taking 1.5x that is an overrun
+void perf_setScanSweepTime(uint32_t us);
+void perf_countScanRefresh(void);
+void perf_recordRenderTime(uint32_t cycles);
+void perf_countRenderOverrun(void);
+void perf_countDroppedFrame(void);
+
+/*
+ * Key to light latency: from a key event arriving to the scan starting
+ * the first sweep of a frame that shows its effect. One key is measured
+ * at a time; a key whose frame changes nothing is not measured.
+ * Bucket i counts latencies below 2^i ms, the last one the rest.
+ */
+#define PERF_LATENCY_BUCKETS 8
+
+void perf_keyEventReceived(void);
+bool perf_takeKeyEvent(uint32_t* startCycles);
+void perf_recordKeyLatency(uint32_t cycles);
+
+/*
+ * Low-power idle: time spent asleep, and the latency from the command
+ * that wakes the render thread to the end of its first frame.
+ */
+void perf_sleepEntered(void);
+void perf_sleepLeft(void);
+void perf_wakeRequested(void);
+void perf_wakeFrameDone(void);
+
+uint16_t perf_getRefreshRate(void);
+uint8_t perf_getIdlePercent(void);
+void perf_getRenderTime(uint32_t* minCycles, uint32_t* avgCycles, uint32_t* maxCycles);
+uint32_t perf_getRenderOverruns(void);
+uint32_t perf_getDroppedFrames(void);
+uint32_t perf_getScanOverruns(void);
+// unused stack of every thread in creation order (main, idle, render), returns the thread count
+uint8_t perf_getStackFree(uint16_t* freeBytes, uint8_t maxThreads);
+void perf_getKeyLatency(uint16_t* histogram, uint32_t* maxCycles);
+// asleep time includes a sleep still going on
+uint32_t perf_getSleepMs(void);
+uint32_t perf_getSleepCount(void);
+void perf_getWakeLatency(uint32_t* lastCycles, uint32_t* maxCycles);
@@ -1,6 +1,7 @@
 #include "profiles.h"
 #include "stdlib.h"
 #include "common_utils.h"
+#include "miniFastLED.h"
 
 
 
@@ -25,7 +26,7 @@ static const led_t turkiz  = {0, 255, 255};
 
 static void setAllColors(led_t* ledColors, const led_t* color) {
     for (int i = 0; i < NUM_ROW * NUM_COLUMN; i++) {
-        ledColors[i] = *color;
+        setLedColor(ledColors, i, color);
     }
 }
 
@@ -37,14 +38,28 @@ static bool legitPosition(const pos_i* pos) {
 
 static void setColor(led_t* ledColors, const pos_i* pos, const led_t* color) {
     if (legitPosition(pos))
-        ledColors[pos->y * NUM_COLUMN + pos->x] = *color;
+        setLedColor(ledColors, pos->y * NUM_COLUMN + pos->x, color);
 }
 
 
-static void multiplyColor(const led_t* sourceColor, uint8_t brightness, led_t* destColor) {
-    destColor->red   = (((int)sourceColor->red)   * brightness / 100);
-    destColor->green = (((int)sourceColor->green) * brightness / 100);
-    destColor->blue  = (((int)sourceColor->blue)  * brightness / 100);
+/*
+ * Color scales go from 0 to 256 (256 = unchanged) so that scaling is a
+ * multiply and a shift. The M0+ has no hardware divider, every '/ 100'
+ * is a call into the software division routine.
+ */
+#define SCALE_MAX 256
+#define PERCENT_TO_SCALE(p) (((p) * 41) >> 4)
+
+static void scaleColor(const led_t* sourceColor, uint16_t scale, led_t* destColor) {
+    destColor->red   = (sourceColor->red   * scale) >> 8;
+    destColor->green = (sourceColor->green * scale) >> 8;
+    destColor->blue  = (sourceColor->blue  * scale) >> 8;
+}
+
+static void setScaledColor(led_t* ledColors, uint8_t idx, const led_t* color, uint16_t scale) {
+    led_t scaledColor;
+    scaleColor(color, scale, &scaledColor);
+    setLedColor(ledColors, idx, &scaledColor);
 }
 
 
@@ -56,104 +71,123 @@ uint8_t getReactiveFps() {
 
 
 void blendColors(led_t* color1, led_t* color2, led_t* destColor) {
-    destColor->red   = (((int)color1->red   + color2->red) / 2);
-    destColor->green = (((int)color1->green + color2->green) / 2);
-    destColor->blue  = (((int)color1->blue  + color2->blue) / 2);
+    destColor->red   = (color1->red   + color2->red) >> 1;
+    destColor->green = (color1->green + color2->green) >> 1;
+    destColor->blue  = (color1->blue  + color2->blue) >> 1;
 }
 
 
 
 ////// Rainbow Flow //////
 
-static uint8_t flowValue[NUM_COLUMN] = {
-  0, 11, 22, 33, 44, 55, 66, 77,
-  88, 99, 110, 121, 132, 143
-};
-void animatedRainbowFlow(led_t* ledColors){
+typedef struct {
+    uint8_t flowValue[NUM_COLUMN];
+} rainbowState;
+
+static void prof_rainbowFlow_init(led_t* ledColors, void* ctx) {
+    rainbowState* state = ctx;
+
+    for (uint8_t i = 0; i < NUM_COLUMN; i++)
+        state->flowValue[i] = i * 11;
+}
+
+static void prof_rainbowFlow_tick(led_t* ledColors, void* ctx){
+  rainbowState* state = ctx;
+
   for(int i = 0; i < NUM_COLUMN; i++){
-    setColumnColorHSV(ledColors, i, flowValue[i], 255, 125);
-    if(flowValue[i] == 179){
-      flowValue[i] = 240;
+    setColumnColorHSV(ledColors, i, state->flowValue[i], 255, 125);
+    if(state->flowValue[i] == 179){
+      state->flowValue[i] = 240;
     }
-    flowValue[i]++;
+    state->flowValue[i]++;
   }
 }
 
+const Profile prof_rainbowFlow = { 30, prof_rainbowFlow_tick, prof_rainbowFlow_init, 0, sizeof(rainbowState), 0 };
+
 
 ////// Rain //////
 
 const led_t rainColor = {30, 30, 255};
 
 #define raindropsBufferSize 40
+#define trailLength 6
+// brightness of the trail, 256 - distance * 256 / trailLength
+static const uint16_t trailScale[trailLength + 1] = { 256, 213, 171, 128, 85, 43, 0 };
 
-static uint8_t raindropCnt = 0;
-static pos_i raindrops[raindropsBufferSize];
+static const systime_t rainSpeedMs = 55;
 
-systime_t nextRainSpawn = 0;
-static const uint8_t trailLength = 6;
+typedef struct {
+    pos_i raindrops[raindropsBufferSize];
+    uint8_t raindropCnt;
+    uint8_t rainIntensity;
+    systime_t nextRainSpawn;
+    systime_t lastMoved;
+} rainState;
 
-uint8_t rainIntensity = 50;
-const systime_t rainSpeedMs = 55;
-systime_t lastMoved = 0;
+static void prof_rain_init(led_t* ledColors, void* ctx) {
+    rainState* state = ctx;
 
-void prof_rain_init(led_t* ledColors) {
-    raindropCnt = 0;
-    nextRainSpawn = 0;
-    lastMoved = 0;
-    rainIntensity = 50;
+    state->raindropCnt = 0;
+    state->nextRainSpawn = 0;
+    state->lastMoved = 0;
+    state->rainIntensity = 50;
 }
 
-void prof_rain_tick(led_t* ledColors) {
-    if (sysTimeMs() - lastMoved > rainSpeedMs) {
-        for (size_t i = 0; i < raindropCnt; i++) {
+static void prof_rain_tick(led_t* ledColors, void* ctx) {
+    rainState* state = ctx;
+    pos_i* raindrops = state->raindrops;
+
+    if (sysTimeMs() - state->lastMoved > rainSpeedMs) {
+        for (size_t i = 0; i < state->raindropCnt; i++) {
             raindrops[i].y++;
         }
         
         setAllColors(ledColors, &black);
-        for (uint8_t i = 0; i < raindropCnt; i++) {
+        for (uint8_t i = 0; i < state->raindropCnt; i++) {
             for (uint8_t y = 0; y < NUM_ROW && y <= raindrops[i].y; y++) {
                 if (raindrops[i].y - y < trailLength + 1) {
-                    uint8_t brightness = 100 - ((raindrops[i].y - y) * 100 / trailLength);
-
                     pos_i currPos = { raindrops[i].x, y };
                     led_t multipliedColor;
-                    multiplyColor(&rainColor, brightness, &multipliedColor);
+                    scaleColor(&rainColor, trailScale[raindrops[i].y - y], &multipliedColor);
 
                     if (currPos.y >= 0 && currPos.y < NUM_ROW) {
-                        ledColors[currPos.y * NUM_COLUMN + currPos.x] = multipliedColor;
+                        setLedColor(ledColors, currPos.y * NUM_COLUMN + currPos.x, &multipliedColor);
                     }
                 }
             }
         }
 
-        lastMoved = sysTimeMs();
+        state->lastMoved = sysTimeMs();
     }
 
 
     size_t deleteRainIdx = 0;
-    while (deleteRainIdx < raindropCnt && raindrops[deleteRainIdx].y >= NUM_ROW + trailLength + 1) {
+    while (deleteRainIdx < state->raindropCnt && raindrops[deleteRainIdx].y >= NUM_ROW + trailLength + 1) {
         deleteRainIdx++;
     }
 
-    for (size_t i = deleteRainIdx; i < raindropCnt; i++) {
+    for (size_t i = deleteRainIdx; i < state->raindropCnt; i++) {
       raindrops[i-deleteRainIdx] = raindrops[i];
     }
-    raindropCnt -= deleteRainIdx;
+    state->raindropCnt -= deleteRainIdx;
     
 
-    if (nextRainSpawn <= sysTimeMs()) {
-        if (raindropCnt < raindropsBufferSize) {
-            raindrops[raindropCnt].x = randInt() % NUM_COLUMN;
-            raindrops[raindropCnt].y = 0;
+    if (state->nextRainSpawn <= sysTimeMs()) {
+        if (state->raindropCnt < raindropsBufferSize) {
+            raindrops[state->raindropCnt].x = randInt() % NUM_COLUMN;
+            raindrops[state->raindropCnt].y = 0;
 
-            raindropCnt++;
+            state->raindropCnt++;
         }
 
         // range of the intensity multiplier is : 50% - 300%
-        nextRainSpawn = sysTimeMs() + (randInt() % 50 + 30) * (120 - rainIntensity) * 5 / 200;
+        state->nextRainSpawn = sysTimeMs() + (randInt() % 50 + 30) * (120 - state->rainIntensity) * 5 / 200;
     }
 }
 
+const Profile prof_rain = { 30, prof_rain_tick, prof_rain_init, 0, sizeof(rainState), 0 };
+
 
 ////// Thunder //////
 
@@ -167,68 +201,78 @@ typedef struct {
     bool state;
 } lightning;
 
-lightning lightn;
-
-systime_t nextLightnSpawn = 0;
+typedef struct {
+    rainState rain;
+    lightning lightn;
+    systime_t nextLightnSpawn;
+    uint8_t stormIntensity;
+} stormState;
 
-uint8_t stormIntensity = 50;
+static void prof_storm_init(led_t* ledColors, void* ctx) {
+    stormState* state = ctx;
 
-void prof_storm_init(led_t* ledColors) {
-    prof_rain_init(ledColors);
-    stormIntensity = 50;
+    prof_rain_init(ledColors, &state->rain);
+    state->lightn = (lightning){ 0 };
+    state->nextLightnSpawn = 0;
+    state->stormIntensity = 50;
 }
 
-void prof_storm_tick(led_t* ledColors) {
+static void prof_storm_tick(led_t* ledColors, void* ctx) {
+    stormState* state = ctx;
+    lightning* lightn = &state->lightn;
+
     // Call rain animation
-    prof_rain_tick(ledColors);
+    prof_rain_tick(ledColors, &state->rain);
 
     // Add lightning
-    if (sysTimeMs() >= nextLightnSpawn) {
-        lightn.col = randInt() % NUM_COLUMN;
-        lightn.maxFlashes = randInt() % 6 + 1;
-        lightn.currFlash = 0;
-        lightn.state = 0;
-        lightn.timeThreshold = sysTimeMs();
+    if (sysTimeMs() >= state->nextLightnSpawn) {
+        lightn->col = randInt() % NUM_COLUMN;
+        lightn->maxFlashes = randInt() % 6 + 1;
+        lightn->currFlash = 0;
+        lightn->state = 0;
+        lightn->timeThreshold = sysTimeMs();
 
         // range of the intensity multiplier is : 50% - 250%
-        nextLightnSpawn = sysTimeMs() + (randInt() % 9000 + 2000) * (125 - stormIntensity) / 50;
+        state->nextLightnSpawn = sysTimeMs() + (randInt() % 9000 + 2000) * (125 - state->stormIntensity) / 50;
     }
 
 
-    lightn.intensity -= 5;
-    if (lightn.intensity < 0) {
-        lightn.intensity = 0;
+    lightn->intensity -= 5;
+    if (lightn->intensity < 0) {
+        lightn->intensity = 0;
     }
 
 
-    if (lightn.intensity < 10 && lightn.currFlash >= lightn.maxFlashes) {
-        lightn.intensity = 0;
+    if (lightn->intensity < 10 && lightn->currFlash >= lightn->maxFlashes) {
+        lightn->intensity = 0;
     }
 
 
-    if (lightn.currFlash < lightn.maxFlashes && lightn.timeThreshold <= sysTimeMs()) {
-        lightn.currFlash++;
-        lightn.state = !lightn.state;
-        lightn.intensity = randInt() % 30 + 71;
+    if (lightn->currFlash < lightn->maxFlashes && lightn->timeThreshold <= sysTimeMs()) {
+        lightn->currFlash++;
+        lightn->state = !lightn->state;
+        lightn->intensity = randInt() % 30 + 71;
         
-        if (lightn.state) {
-            lightn.timeThreshold = sysTimeMs() + randInt() % 700 + 150;
+        if (lightn->state) {
+            lightn->timeThreshold = sysTimeMs() + randInt() % 700 + 150;
         }
         else {
-            lightn.timeThreshold = sysTimeMs() + randInt() % 40 + 30;
+            lightn->timeThreshold = sysTimeMs() + randInt() % 40 + 30;
         }
     }
 
-    if (lightn.state || (lightn.intensity && lightn.currFlash >= lightn.maxFlashes)) {
+    if (lightn->state || (lightn->intensity && lightn->currFlash >= lightn->maxFlashes)) {
         led_t lightnColor = {200, 255, 255};
-        multiplyColor(&lightnColor, lightn.intensity, &lightnColor);
+        scaleColor(&lightnColor, PERCENT_TO_SCALE(lightn->intensity), &lightnColor);
 
         for (uint8_t y = 0; y < NUM_ROW; y++) {
-            ledColors[y * NUM_COLUMN + lightn.col] = lightnColor;
+            setLedColor(ledColors, y * NUM_COLUMN + lightn->col, &lightnColor);
         }
     }
 }
 
+const Profile prof_storm = { 30, prof_storm_tick, prof_storm_init, 0, sizeof(stormState), 0 };
+
 
 
 ////// Breathing //////
@@ -236,46 +280,55 @@ void prof_storm_tick(led_t* ledColors) {
 typedef struct {
     pos_i pos;
     led_t color;
-    int brightness;
+    int16_t brightness; // 0 - SCALE_MAX
 } breathKeypress;
 
 #define breathKeypressBuffSize 25
-static breathKeypress breathKeypresses[breathKeypressBuffSize];
-static size_t breathKeypressCount = 0;
-static uint8_t breathFadeSpeed;
-static bool breathRandomColor;
-static led_t breathColor = turkiz;
+
+typedef struct {
+    breathKeypress breathKeypresses[breathKeypressBuffSize];
+    uint8_t breathKeypressCount;
+    uint8_t breathFadeSpeed;
+    bool breathRandomColor;
+    led_t breathColor;
+} breathState;
 
 
-void prof_breathing_tick(led_t* ledColors) {
+static void prof_breathing_tick(led_t* ledColors, void* ctx) {
+    breathState* state = ctx;
+    breathKeypress* breathKeypresses = state->breathKeypresses;
+
     setAllColors(ledColors, &black);
-    for (size_t i = 0; i < breathKeypressCount; i++) {
-        multiplyColor(&breathKeypresses[i].color, breathKeypresses[i].brightness, 
-            &ledColors[breathKeypresses[i].pos.y * NUM_COLUMN + breathKeypresses[i].pos.x]);
+    for (size_t i = 0; i < state->breathKeypressCount; i++) {
+        setScaledColor(ledColors, breathKeypresses[i].pos.y * NUM_COLUMN + breathKeypresses[i].pos.x,
+            &breathKeypresses[i].color, breathKeypresses[i].brightness);
 
-        breathKeypresses[i].brightness -= breathFadeSpeed;
+        breathKeypresses[i].brightness -= state->breathFadeSpeed;
     }
 
 
     size_t deleteTapIdx = 0;
-    while (deleteTapIdx < breathKeypressCount && breathKeypresses[deleteTapIdx].brightness <= 0) {
+    while (deleteTapIdx < state->breathKeypressCount && breathKeypresses[deleteTapIdx].brightness <= 0) {
         deleteTapIdx++;
     }
 
-    for (size_t i = deleteTapIdx; i < breathKeypressCount; i++) {
+    for (size_t i = deleteTapIdx; i < state->breathKeypressCount; i++) {
       breathKeypresses[i-deleteTapIdx] = breathKeypresses[i];
     }
-    breathKeypressCount -= deleteTapIdx;
+    state->breathKeypressCount -= deleteTapIdx;
 }
 
-void prof_breathing_init(led_t* ledColors) {
-    breathKeypressCount = 0;
-    breathRandomColor = true;
-    breathFadeSpeed = 8;
+static void prof_breathing_init(led_t* ledColors, void* ctx) {
+    breathState* state = ctx;
+
+    state->breathKeypressCount = 0;
+    state->breathRandomColor = true;
+    state->breathColor = turkiz;
+    state->breathFadeSpeed = 20;
 }
 
 
-static led_t breathing_colors[] = {
+static const led_t breathing_colors[] = {
     red,
     green,
     blue,
@@ -286,23 +339,31 @@ static led_t breathing_colors[] = {
     turkiz
 };
 
-void prof_breathing_pressed(uint8_t x, uint8_t y, led_t* ledColors) {
-    if(breathKeypressCount < breathKeypressBuffSize) {
-        breathKeypresses[breathKeypressCount].pos.x = x;
-        breathKeypresses[breathKeypressCount].pos.y = y;
+static void prof_breathing_pressed(uint8_t x, uint8_t y, led_t* ledColors, void* ctx) {
+    breathState* state = ctx;
+
+    if(state->breathKeypressCount < breathKeypressBuffSize) {
+        breathKeypress* keypress = &state->breathKeypresses[state->breathKeypressCount];
+        keypress->pos.x = x;
+        keypress->pos.y = y;
 
-        if (breathRandomColor)
-            breathKeypresses[breathKeypressCount].color = 
-                breathing_colors[randInt() % LEN(breathing_colors)];
+        if (state->breathRandomColor)
+            keypress->color = breathing_colors[randInt() % LEN(breathing_colors)];
         else
-            breathKeypresses[breathKeypressCount].color = breathColor;
+            keypress->color = state->breathColor;
 
-        breathKeypresses[breathKeypressCount].brightness = 100;
+        keypress->brightness = SCALE_MAX;
 
-        breathKeypressCount++;
+        // lit right away, the tick takes over the fade from here
+        setScaledColor(ledColors, y * NUM_COLUMN + x, &keypress->color, keypress->brightness);
+        keypress->brightness -= state->breathFadeSpeed;
+
+        state->breathKeypressCount++;
     }
 }
 
+const Profile prof_breathing = { 30, prof_breathing_tick, prof_breathing_init, prof_breathing_pressed, sizeof(breathState), 0 };
+
 
 
 ////// Snowing //////
@@ -314,16 +375,21 @@ typedef struct {
 } snowflake;
 
 #define snowflakesBufferSize 30
-snowflake snowflakes[snowflakesBufferSize];
-uint8_t snowflakeCnt = 0;
 
-int snowflakeSpawnTimer = 0;
-uint8_t snowIntensity = 50;
+typedef struct {
+    snowflake snowflakes[snowflakesBufferSize];
+    uint8_t snowflakeCnt;
+    uint8_t snowIntensity;
+    int8_t snowflakeSpawnTimer;
+} snowState;
+
+static void prof_snowing_tick(led_t* ledColors, void* ctx) {
+    snowState* state = ctx;
+    snowflake* snowflakes = state->snowflakes;
 
-void prof_snowing_tick(led_t* ledColors) {
     setAllColors(ledColors, &black);
 
-    for (int i = 0; i < snowflakeCnt; i++) {
+    for (int i = 0; i < state->snowflakeCnt; i++) {
         setColor(ledColors, &snowflakes[i].pos, &white);
         if (--snowflakes[i].timer <= 0) {
             snowflakes[i].pos.y++;
@@ -334,106 +400,123 @@ void prof_snowing_tick(led_t* ledColors) {
 
     //// delete snowflakes
     uint8_t deleteIdx = 0;
-    while (deleteIdx < snowflakeCnt && snowflakes[deleteIdx].pos.y >= 5) {
+    while (deleteIdx < state->snowflakeCnt && snowflakes[deleteIdx].pos.y >= 5) {
         deleteIdx++;
     }
 
-    for (size_t i = deleteIdx; i < snowflakeCnt; i++) {
+    for (size_t i = deleteIdx; i < state->snowflakeCnt; i++) {
       snowflakes[i-deleteIdx] = snowflakes[i];
     }
-    snowflakeCnt -= deleteIdx;
+    state->snowflakeCnt -= deleteIdx;
 
 
     //// spawn snowflakes
-    if (--snowflakeSpawnTimer <= 0) {
-        if (snowflakeCnt < snowflakesBufferSize) {
-            snowflakes[snowflakeCnt].pos.x = randInt() % NUM_COLUMN;
-            snowflakes[snowflakeCnt].pos.y = -1;
-            snowflakes[snowflakeCnt].fallSpeed = randInt() % 3 + 6;
-            snowflakes[snowflakeCnt].timer = 0;
-
-            snowflakeCnt++;
+    if (--state->snowflakeSpawnTimer <= 0) {
+        if (state->snowflakeCnt < snowflakesBufferSize) {
+            snowflake* flake = &snowflakes[state->snowflakeCnt];
+            flake->pos.x = randInt() % NUM_COLUMN;
+            flake->pos.y = -1;
+            flake->fallSpeed = randInt() % 3 + 6;
+            flake->timer = 0;
+
+            state->snowflakeCnt++;
         }
 
         // snowflakeSpawnTimer = randInt() % 4 + 6;
-        snowflakeSpawnTimer = randInt() % ((105-snowIntensity) / 3) + 3;
+        state->snowflakeSpawnTimer = randInt() % ((105 - state->snowIntensity) / 3) + 3;
     }
 }
 
-void prof_snowing_init(led_t* ledColors) {
-    snowflakeCnt = 0;
-    snowIntensity = 50;
+static void prof_snowing_init(led_t* ledColors, void* ctx) {
+    snowState* state = ctx;
+
+    state->snowflakeCnt = 0;
+    state->snowflakeSpawnTimer = 0;
+    state->snowIntensity = 50;
 }
 
+const Profile prof_snowing = { 30, prof_snowing_tick, prof_snowing_init, 0, sizeof(snowState), 0 };
+
 
 ////// Locked ////// 
 
-led_t locked_color = {255, 20, 20};
+static const led_t locked_color = {255, 20, 20};
+
+typedef struct {
+    int8_t lockedIntensity;
+    bool lockedAnimDir;
+} lockedState;
 
-uint8_t lockedIntensity = 0;
-bool lockedAnimDir = 1;
+static void prof_locked_tick(led_t* ledColors, void* ctx) {
+    lockedState* state = ctx;
 
-void prof_locked_tick(led_t* ledColors) {
-    if (lockedAnimDir) {
-        lockedIntensity += 2;
+    if (state->lockedAnimDir) {
+        state->lockedIntensity += 2;
 
-        if (lockedIntensity >= 100) {
-            lockedAnimDir = 0;
+        if (state->lockedIntensity >= 100) {
+            state->lockedAnimDir = 0;
         }
     }
     else {
-        lockedIntensity--;
+        state->lockedIntensity--;
 
-        if (lockedIntensity <= 0) {
-            lockedAnimDir = 1;
+        if (state->lockedIntensity <= 0) {
+            state->lockedAnimDir = 1;
         }
     }
 
     led_t multipliedColor;
-    multiplyColor(&locked_color, lockedIntensity, &multipliedColor);
+    scaleColor(&locked_color, PERCENT_TO_SCALE(state->lockedIntensity), &multipliedColor);
     
     setAllColors(ledColors, &multipliedColor);
 }
 
-void prof_locked_init(led_t* ledColors) {
-    lockedIntensity = 0;
-    lockedAnimDir = 1;
+static void prof_locked_init(led_t* ledColors, void* ctx) {
+    lockedState* state = ctx;
+
+    state->lockedIntensity = 0;
+    state->lockedAnimDir = 1;
 }
 
+const Profile prof_locked = { 30, prof_locked_tick, prof_locked_init, 0, sizeof(lockedState), 0 };
+
 
 ////// Stars //////
 
 typedef struct {
     pos_i pos;
-    uint8_t intensity;
+    uint16_t intensity; // 0 - SCALE_MAX
 } star;
 
 
 static const star stars[] = {
-    { {1, 0}, 40 },
-    { {1, 2}, 100 },
-    { {5, 1}, 30 },
-    { {11, 3}, 60 },
-    { {6, 4}, 100 },
-    { {13, 1}, 85 },
-    { {8, 0}, 15 },
-    { {8, 2}, 50 },
-    { {3, 3}, 10 },
+    { {1, 0}, 102 },
+    { {1, 2}, 256 },
+    { {5, 1}, 77 },
+    { {11, 3}, 154 },
+    { {6, 4}, 256 },
+    { {13, 1}, 218 },
+    { {8, 0}, 38 },
+    { {8, 2}, 128 },
+    { {3, 3}, 26 },
 };
 
-void prof_stars_tick(led_t* ledColors) {
+static void prof_stars_tick(led_t* ledColors, void* ctx) {
     setAllColors(ledColors, &black);
 
     for (uint8_t i = 0; i < LEN(stars); i++) {
-        uint8_t intensityMod = randInt() % 60 + 70;
-        int intensity = stars[i].intensity * intensityMod / 100;
-        if (intensity > 100) 
-            intensity = 100;
+        // flicker between 70% and 129% (90..165 / 128)
+        uint16_t intensityMod = (((randInt() & 0x7F) * 76) >> 7) + 90;
+        uint16_t intensity = (stars[i].intensity * intensityMod) >> 7;
+        if (intensity > SCALE_MAX) 
+            intensity = SCALE_MAX;
 
-        multiplyColor(&white, intensity, &ledColors[stars[i].pos.y * NUM_COLUMN + stars[i].pos.x]);
+        setScaledColor(ledColors, stars[i].pos.y * NUM_COLUMN + stars[i].pos.x, &white, intensity);
     }
 }
 
+const Profile prof_stars = { 6, prof_stars_tick, 0, 0, 0, 0 };
+
 
 #include "math.h"
 
@@ -448,11 +531,18 @@ static uint8_t angles[] = {
 };
 
 
-static uint16_t sunRotation = 0;
-static pos_i sunPos = {0, 0};
+// rays repeat every 72 degrees, so only the rotation modulo 72 matters
+#define sunRayAngle 72
+static const pos_i sunPos = {0, 0};
+
+typedef struct {
+    uint8_t sunRotation;
+} sunnyState;
+
 
+static void prof_sunny_tick(led_t* ledColors, void* ctx) {
+    sunnyState* state = ctx;
 
-void prof_sunny_tick(led_t* ledColors) {
     for (uint8_t y = 0; y < NUM_ROW; y++) {
         for (uint8_t x = 0; x < NUM_COLUMN; x++) {
             uint8_t x_rel = abs(x - sunPos.x);
@@ -463,27 +553,33 @@ void prof_sunny_tick(led_t* ledColors) {
             // else
                 // angle = (270 + sunRotation) % 360;
 
-            angle = (angles[y * NUM_COLUMN + x] + sunRotation) % 360;
-
-            uint8_t brightness = (abs((angle % 72) - 36)) * ((int)100) / 36;
-            if (brightness > 100)
-                brightness = 100;
+            angle = angles[y * NUM_COLUMN + x] + state->sunRotation;
+            while (angle >= sunRayAngle)
+                angle -= sunRayAngle;
 
-            brightness = (int)brightness /* * sunIntensity / 100*/;
+            // 0 - 36 degrees from the middle of a ray, * 256 / 36
+            uint16_t brightness = (abs(angle - sunRayAngle / 2) * 57) >> 3;
+            if (brightness > SCALE_MAX)
+                brightness = SCALE_MAX;
 
-            multiplyColor(&yellow, brightness, &ledColors[y * NUM_COLUMN + x]);
+            setScaledColor(ledColors, y * NUM_COLUMN + x, &yellow, brightness);
         }
     }
 
-    ledColors[0] = yellow;
+    setLedColor(ledColors, 0, &yellow);
     
-    sunRotation = (sunRotation + 1) % 360;
+    if (++state->sunRotation == sunRayAngle)
+        state->sunRotation = 0;
 }
 
-void prof_sunny_init(led_t* ledColors) {
-    
+static void prof_sunny_init(led_t* ledColors, void* ctx) {
+    sunnyState* state = ctx;
+
+    state->sunRotation = 0;
 }
 
+const Profile prof_sunny = { 30, prof_sunny_tick, prof_sunny_init, 0, sizeof(sunnyState), 0 };
+
 
 ////// Cloudy ///////
 
@@ -492,105 +588,151 @@ static uint8_t sin_lookup[360] = {
 };
 
 
-static uint8_t cloudDensity = 100;
-static uint16_t cloudPeriod = 0;
-static led_t cloudColor = {130, 200, 200};
+static const led_t cloudColor = {130, 200, 200};
+static const uint16_t cloudRowScale[NUM_ROW + 1] = { 0, 51, 102, 154, 205, 256 };
 
-void prof_cloudy_init(led_t* ledColors) {
-    prof_sunny_init(ledColors);
+typedef struct {
+    sunnyState sun;
+    uint8_t cloudDensity;
+    uint16_t cloudPeriod;
+} cloudyState;
+
+static void prof_cloudy_init(led_t* ledColors, void* ctx) {
+    cloudyState* state = ctx;
+
+    prof_sunny_init(ledColors, &state->sun);
 
-    cloudDensity = 100; 
+    state->cloudDensity = 100; 
+    state->cloudPeriod = 0;
 }
 
-void prof_cloudy_tick(led_t* ledColors) {
-    uint8_t maxRow = NUM_ROW * (cloudDensity + 12) / 100;
+static void prof_cloudy_tick(led_t* ledColors, void* ctx) {
+    cloudyState* state = ctx;
+
+    // NUM_ROW * (cloudDensity + 12) / 100
+    uint8_t maxRow = (NUM_ROW * (state->cloudDensity + 12) * 41) >> 12;
+    if (maxRow > NUM_ROW)
+        maxRow = NUM_ROW;
     
     if (maxRow < NUM_ROW) {
-        prof_sunny_tick(ledColors);
+        prof_sunny_tick(ledColors, &state->sun);
     }
 
-    if (cloudDensity) {
+    if (state->cloudDensity) {
         for (uint8_t x = 0; x < NUM_COLUMN; x++) {
-            uint8_t brightness = sin_lookup[(cloudPeriod + x * 6) % 180];
+            uint16_t phase = state->cloudPeriod + x * 6;
+            if (phase >= 180)
+                phase -= 180;
+
+            // sin_lookup is in percent, each row below the top adds 1/5th
+            uint16_t brightness = PERCENT_TO_SCALE(sin_lookup[phase]);
 
             for (uint8_t y = 0; y < maxRow; y++) {
-                multiplyColor(&cloudColor, (int)brightness * (maxRow-y) * 20 / 100, &ledColors[y * NUM_COLUMN + x]);
+                setScaledColor(ledColors, y * NUM_COLUMN + x, &cloudColor, (brightness * cloudRowScale[maxRow - y]) >> 8);
             }
         }
 
-        cloudPeriod = (cloudPeriod + 1) % 180;
+        if (++state->cloudPeriod == 180)
+            state->cloudPeriod = 0;
     }
 }
 
+const Profile prof_cloudy = { 30, prof_cloudy_tick, prof_cloudy_init, 0, sizeof(cloudyState), 0 };
+
 
 ////// Live Weather //////
 
 static systime_t weatherLastUpdated = 0;
 static bool weatherUpToDate = false;
 static WeatherData weatherData;
-static void(*weatherAnimFn)(led_t*) = 0;
+
+// the weather animations that keep state, only one runs at a time
+typedef union {
+    rainState rain;
+    stormState storm;
+    snowState snow;
+    cloudyState cloudy;
+} weatherAnimState;
+
+typedef struct {
+    anim_tick weatherAnimFn;
+    weatherAnimState anim;
+} liveWeatherState;
 
 void setWeatherData(WeatherData* data) {
     weatherData = *data;
     weatherLastUpdated = sysTimeS();
 }
 
-void prof_liveWeather_init(led_t* ledColors) {
-    void(*prevAnim)(led_t*) = weatherAnimFn;
+static void prof_liveWeather_init(led_t* ledColors, void* ctx) {
+    liveWeatherState* state = ctx;
+    anim_tick prevAnim = state->weatherAnimFn;
 
     if (weatherData.snowIntensity > 0) {
-        weatherAnimFn = prof_snowing_tick;
+        state->weatherAnimFn = prof_snowing_tick;
         reactiveFps = 30;
 
-        if (prevAnim != weatherAnimFn)
-            prof_snowing_init(ledColors);
+        if (prevAnim != state->weatherAnimFn)
+            prof_snowing_init(ledColors, &state->anim.snow);
+
+        state->anim.snow.snowIntensity = weatherData.snowIntensity;
     }
     else if (weatherData.stormIntensity > 0) {
-        weatherAnimFn = prof_storm_tick;
+        state->weatherAnimFn = prof_storm_tick;
         reactiveFps = 30;
 
-        if (prevAnim != weatherAnimFn)
-            prof_storm_init(ledColors);
+        if (prevAnim != state->weatherAnimFn)
+            prof_storm_init(ledColors, &state->anim.storm);
+
+        state->anim.storm.rain.rainIntensity = weatherData.rainIntensity;
     }
     else if (weatherData.rainIntensity > 0) {
-        weatherAnimFn = prof_rain_tick;
+        state->weatherAnimFn = prof_rain_tick;
         reactiveFps = 30;
 
-        if (prevAnim != weatherAnimFn)
-            prof_rain_init(ledColors);
+        if (prevAnim != state->weatherAnimFn)
+            prof_rain_init(ledColors, &state->anim.rain);
+
+        state->anim.rain.rainIntensity = weatherData.rainIntensity;
     }
     else if (!(
         weatherData.time.hour*60 + weatherData.time.minute > weatherData.sunriseTime.hour*60 + weatherData.sunriseTime.minute &&
         weatherData.time.hour*60 + weatherData.time.minute < weatherData.sunsetTime.hour*60 + weatherData.sunsetTime.minute)
         ) {
-        weatherAnimFn = prof_stars_tick;
+        state->weatherAnimFn = prof_stars_tick;
         reactiveFps = 6;
     }
     else {
-        weatherAnimFn = prof_cloudy_tick;
+        state->weatherAnimFn = prof_cloudy_tick;
         reactiveFps = 30;
 
-        if (prevAnim != weatherAnimFn)
-            prof_cloudy_init(ledColors);
+        if (prevAnim != state->weatherAnimFn)
+            prof_cloudy_init(ledColors, &state->anim.cloudy);
+
+        state->anim.cloudy.cloudDensity = weatherData.cloudDensity;
     }
-    
-    snowIntensity = weatherData.snowIntensity;
-    rainIntensity = weatherData.rainIntensity;
-    cloudDensity = weatherData.cloudDensity;
+
+    // a running animation keeps its keys, a new one starts on black
+    if (prevAnim != state->weatherAnimFn)
+        setAllColors(ledColors, &black);
 }
 
-void prof_liveWeather_tick(led_t* ledColors) {
+static void prof_liveWeather_tick(led_t* ledColors, void* ctx) {
+    liveWeatherState* state = ctx;
+
     weatherUpToDate = sysTimeS() - weatherLastUpdated < 650;
 
-    if (weatherUpToDate && weatherAnimFn) {
-        weatherAnimFn(ledColors);
+    if (weatherUpToDate && state->weatherAnimFn) {
+        state->weatherAnimFn(ledColors, &state->anim);
     }
     else {
         setAllColors(ledColors, &black);
-        ledColors[16] = yellow;
+        setLedColor(ledColors, 16, &yellow);
     }
 }
 
+const Profile prof_liveWeather = { REACTIVE_FPS, prof_liveWeather_tick, prof_liveWeather_init, 0, sizeof(liveWeatherState), 0 };
+
 
 WeatherData* getWeatherData(void) {
     return &weatherData;
@@ -621,116 +763,151 @@ Time getCurrentTime() {
 
 ////// Blinking //////
 
-void prof_blink_init(led_t* ledColors) {
-    prof_breathing_init(ledColors);
+typedef struct {
+    breathState breath;
+    systime_t nextBlinkTime;
+} blinkState;
+
+static void prof_blink_init(led_t* ledColors, void* ctx) {
+    blinkState* state = ctx;
 
-    breathRandomColor = false;
-    breathColor = purple;
-    breathFadeSpeed = 4;
+    prof_breathing_init(ledColors, &state->breath);
+
+    state->breath.breathRandomColor = false;
+    state->breath.breathColor = purple;
+    state->breath.breathFadeSpeed = 10;
+    state->nextBlinkTime = 0;
 }
 
-void prof_blink_tick(led_t* ledColors) {
-    static systime_t nextBlinkTime = 0;
+static void prof_blink_tick(led_t* ledColors, void* ctx) {
+    blinkState* state = ctx;
 
     systime_t currTimeMs = sysTimeMs();
-    if (nextBlinkTime <= currTimeMs) {
-        prof_breathing_pressed(randInt() % NUM_COLUMN, randInt() % NUM_ROW, ledColors);
+    if (state->nextBlinkTime <= currTimeMs) {
+        prof_breathing_pressed(randInt() % NUM_COLUMN, randInt() % NUM_ROW, ledColors, &state->breath);
 
-        nextBlinkTime = currTimeMs + 20 + randInt() % 300;
+        state->nextBlinkTime = currTimeMs + 20 + randInt() % 300;
     }
  
-    prof_breathing_tick(ledColors);
+    prof_breathing_tick(ledColors, &state->breath);
 }
 
+const Profile prof_blink = { 30, prof_blink_tick, prof_blink_init, 0, sizeof(blinkState), 0 };
+
 
 
 ////// Weather Showoff //////
 
-static const Profile weatherProfiles[] = {
-    { 30, prof_sunny_tick, prof_sunny_init, 0 },
-    { 30, prof_cloudy_tick, prof_cloudy_init, 0 },
-    { 30, prof_storm_tick, prof_storm_init, 0 },
-    { 6,  prof_stars_tick, 0, 0 },
-    { 30, prof_snowing_tick, prof_snowing_init, 0 },
+static const Profile* const weatherProfiles[] = {
+    &prof_sunny,
+    &prof_cloudy,
+    &prof_storm,
+    &prof_stars,
+    &prof_snowing,
 };
 
-static systime_t nextWeatherSwitchTime;
-static int currWeatherProfile;
+typedef struct {
+    systime_t nextWeatherSwitchTime;
+    int8_t currWeatherProfile;
+    weatherAnimState anim;
+} weatherShowoffState;
+
+static void prof_weatherShowoff_init(led_t* ledColors, void* ctx) {
+    weatherShowoffState* state = ctx;
 
-void prof_weatherShowoff_init(led_t* ledColors) {
-    nextWeatherSwitchTime = 0;
-    currWeatherProfile = -1;
+    state->nextWeatherSwitchTime = 0;
+    state->currWeatherProfile = -1;
 }
 
-void prof_weatherShowoff_tick(led_t* ledColors) {
+static void prof_weatherShowoff_tick(led_t* ledColors, void* ctx) {
     static const uint32_t animDuration = 6;
+    weatherShowoffState* state = ctx;
 
     systime_t currTimeS = sysTimeS();
-    if (nextWeatherSwitchTime <= currTimeS) {
-        nextWeatherSwitchTime = currTimeS + animDuration;
-        currWeatherProfile = (currWeatherProfile + 1) % LEN(weatherProfiles);
+    if (state->nextWeatherSwitchTime <= currTimeS) {
+        state->nextWeatherSwitchTime = currTimeS + animDuration;
+        state->currWeatherProfile = (state->currWeatherProfile + 1) % LEN(weatherProfiles);
 
-        reactiveFps = weatherProfiles[currWeatherProfile].fps;
+        const Profile* profile = weatherProfiles[state->currWeatherProfile];
+        reactiveFps = profile->fps;
 
-        if (weatherProfiles[currWeatherProfile].init)
-            weatherProfiles[currWeatherProfile].init(ledColors);
+        if (profile->init)
+            profile->init(ledColors, &state->anim);
     }
 
-    weatherProfiles[currWeatherProfile].tick(ledColors);
+    weatherProfiles[state->currWeatherProfile]->tick(ledColors, &state->anim);
 }
 
+const Profile prof_weatherShowoff = { REACTIVE_FPS, prof_weatherShowoff_tick, prof_weatherShowoff_init, 0, sizeof(weatherShowoffState), 0 };
+
 
 ////// Weave Effect //////
 
-static led_t powerEffectColor;
+typedef struct {
+    led_t color;
+    int16_t weavePos; // 0 - 100
+} weaveState;
 
-static void effect_weave_init(void) {
-    
+static const uint8_t weaveOffset = 30;
+static const uint8_t weaveWidth = 15;
+
+static void effect_weave_init(weaveState* state, const led_t* color) {
+    state->color = *color;
+    state->weavePos = -weaveOffset;
 }
 
-void effect_weave_green_init(led_t* ledColors) {
-    effect_weave_init();
-    powerEffectColor = green;
+static void effect_weave_green_init(led_t* ledColors, void* ctx) {
+    effect_weave_init(ctx, &green);
 }
 
-void effect_weave_yellow_init(led_t* ledColors) {
-    effect_weave_init();
-    powerEffectColor = yellow;
+static void effect_weave_yellow_init(led_t* ledColors, void* ctx) {
+    effect_weave_init(ctx, &yellow);
 }
 
-void effect_weave_red_init(led_t* ledColors) {
-    effect_weave_init();
-    powerEffectColor = red;
+static void effect_weave_red_init(led_t* ledColors, void* ctx) {
+    effect_weave_init(ctx, &red);
 }
 
-bool effect_weave_tick(led_t* ledColors) {
-    static const uint8_t weaveOffset = 30;
-    static int16_t weavePos = -weaveOffset; // 0 - 100
-    static const uint8_t weaveWidth = 15;
-    
-    setAllColors(ledColors, &black);
+// x * 100 / (NUM_COLUMN - 1)
+static const uint8_t weaveColumnPos[NUM_COLUMN] = {
+    0, 7, 15, 23, 30, 38, 46, 53, 61, 69, 76, 84, 92, 100
+};
+
+static bool effect_weave_tick(void* ctx) {
+    weaveState* state = ctx;
+
+    state->weavePos += 3;
+
+    return state->weavePos < 100 + weaveOffset;
+}
+
+static void effect_weave_draw(led_t* ledColors, const void* ctx) {
+    const weaveState* state = ctx;
 
     for (int x = 0; x < NUM_COLUMN; x++) {
-        int distance = abs(((int)x * 100 / (NUM_COLUMN - 1)) - weavePos);
+        int distance = abs(weaveColumnPos[x] - state->weavePos);
         if (distance >= weaveWidth)
             continue;
             
-        int brightness = (int)(weaveWidth - distance) * 100 / weaveWidth;
+        // (weaveWidth - distance) * 256 / weaveWidth
+        uint16_t brightness = ((weaveWidth - distance) * 4370) >> 8;
 
         for (int y = 0; y < NUM_ROW; y++) {
-            multiplyColor(&powerEffectColor, brightness, &ledColors[y * NUM_COLUMN + x]);
+            setScaledColor(ledColors, y * NUM_COLUMN + x, &state->color, brightness);
         }
     }
+}
 
-    weavePos += 3;
+const Effect effect_weave_green  = { effect_weave_green_init, effect_weave_tick, effect_weave_draw, 60, sizeof(weaveState) };
+const Effect effect_weave_yellow = { effect_weave_yellow_init, effect_weave_tick, effect_weave_draw, 60, sizeof(weaveState) };
+const Effect effect_weave_red    = { effect_weave_red_init, effect_weave_tick, effect_weave_draw, 60, sizeof(weaveState) };
 
-    if (weavePos >= 100 + weaveOffset) {
-        weavePos = -weaveOffset;
-        return false;
-    }
-    
-    return true;
-}
+
+// Private states have to fit the slots the caller provides
+_Static_assert(sizeof(blinkState) <= PROFILE_STATE_SIZE, "blink state too large");
+_Static_assert(sizeof(weatherShowoffState) <= PROFILE_STATE_SIZE, "weather showoff state too large");
+_Static_assert(sizeof(liveWeatherState) <= PROFILE_STATE_SIZE, "live weather state too large");
+_Static_assert(sizeof(weaveState) <= EFFECT_STATE_SIZE, "weave state too large");
 
 
 ////// Blinking Effect //////
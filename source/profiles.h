@@ -6,26 +6,41 @@
 #define REACTIVE_FPS 0
 
 
-typedef void (*anim_tick)( led_t* );
-typedef void (*anim_keypress)( uint8_t col, uint8_t row, led_t* keyColors );
-typedef void (*anim_init)( led_t* );
+/*
+ * Profiles and effects keep no globals, every call gets a pointer to the
+ * instance's private state (ctx). The caller owns the storage: stateSize
+ * bytes, zeroed before init, at most PROFILE_STATE_SIZE / EFFECT_STATE_SIZE.
+ */
+#define PROFILE_STATE_SIZE  216
+#define EFFECT_STATE_SIZE   8
+
+typedef void (*anim_tick)( led_t*, void* ctx );
+typedef void (*anim_keypress)( uint8_t col, uint8_t row, led_t* keyColors, void* ctx );
+typedef void (*anim_keyrelease)( uint8_t col, uint8_t row, uint16_t heldMs, led_t* keyColors, void* ctx );
+typedef void (*anim_init)( led_t*, void* ctx );
 
 typedef struct {
   uint8_t fps;
   anim_tick tick;
   anim_init init;
   anim_keypress keypress;
+  uint16_t stateSize;
+  anim_keyrelease keyrelease; // optional, keys pressed with LED_KEY_PRESSED never release
 } Profile;
 
 
-// tick function for one-shot effects
+// tick function for one-shot effects, advances the state by one step
 // returns false if effect is done
-typedef bool (*oneShot_tick)( led_t* );
+typedef bool (*oneShot_tick)( void* ctx );
+// draws the current step, only writes the keys the effect lights
+typedef void (*oneShot_draw)( led_t*, const void* ctx );
 
 typedef struct {
     anim_init init; // == 0 when disabled
     oneShot_tick tick; 
+    oneShot_draw draw;
     uint8_t fps;
+    uint16_t stateSize;
 } Effect;
 
 
@@ -38,31 +53,18 @@ void blendColors(led_t* color1, led_t* color2, led_t* dest);
 
 uint8_t getReactiveFps(void);
 
-void animatedRainbowFlow(led_t* ledColors);
-
-void prof_rain_init(led_t* ledColors);
-void prof_rain_tick(led_t* keyColors);
-
-void prof_storm_init(led_t* ledColors);
-void prof_storm_tick(led_t* keyColors);
-
-void prof_breathing_init(led_t* ledColors);
-void prof_breathing_tick(led_t* keyColors);
-void prof_breathing_pressed(uint8_t x, uint8_t y, led_t* keyColors);
-
-void prof_snowing_init(led_t* ledColors);
-void prof_snowing_tick(led_t* keyColors);
-
-void prof_locked_init(led_t* ledColors);
-void prof_locked_tick(led_t* ledColors);
-
-void prof_stars_tick(led_t* ledColors);
-
-void prof_sunny_init(led_t* ledColors);
-void prof_sunny_tick(led_t* ledColors);
-
-void prof_cloudy_init(led_t* ledColors);
-void prof_cloudy_tick(led_t* ledColors);
+extern const Profile prof_rainbowFlow;
+extern const Profile prof_rain;
+extern const Profile prof_storm;
+extern const Profile prof_breathing;
+extern const Profile prof_snowing;
+extern const Profile prof_locked;
+extern const Profile prof_stars;
+extern const Profile prof_sunny;
+extern const Profile prof_cloudy;
+extern const Profile prof_liveWeather;
+extern const Profile prof_blink;
+extern const Profile prof_weatherShowoff;
 
 
 typedef struct {
@@ -87,25 +89,17 @@ typedef struct {
     bool mist;
 } WeatherData;
 
-void prof_liveWeather_init(led_t* ledColors);
-void prof_liveWeather_tick(led_t* ledColors);
 void setWeatherData(WeatherData* data);
 WeatherData* getWeatherData(void);
 bool weatherIsUpToDate(void);
 Time getCurrentTime(void);
 
-void prof_blink_init(led_t* ledColors);
-void prof_blink_tick(led_t* ledColors);
-
-void prof_weatherShowoff_init(led_t* ledColors);
-void prof_weatherShowoff_tick(led_t* ledColors);
 
 
 
-void effect_weave_green_init(led_t* ledColors);
-void effect_weave_yellow_init(led_t* ledColors);
-void effect_weave_red_init(led_t* ledColors);
-bool effect_weave_tick(led_t* ledColors);
+extern const Effect effect_weave_green;
+extern const Effect effect_weave_yellow;
+extern const Effect effect_weave_red;
 
 void effect_blt_init(uint8_t bltState);
 void effect_blinking_disable(void);